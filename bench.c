@@ -0,0 +1,198 @@
+#define NOB_IMPLEMENTATION
+#define NOB_STRIP_PREFIX
+#include "nob.h"
+
+#define TRACE_IMPLEMENTATION
+#include "trace.h"
+
+#define PERF_IMPLEMENTATION
+#include "perf.h"
+
+#define SIM_IMPLEMENTATION
+#include "sim.h"
+
+#define SCENES_IMPLEMENTATION
+#include "scenes.h"
+
+#include <inttypes.h>
+
+// Headless benchmark: runs every scene at every size for a fixed number of ticks
+// and prints one JSON report on stdout. Progress goes to stderr.
+
+#define BENCH_SEED 0x5eed
+#define BENCH_TICKS_DEFAULT 500
+
+static const int bench_sizes[] = { 256, 1024, 2048 };
+
+typedef struct {
+    double *items;
+    size_t count, capacity;
+} Tick_Times;
+
+static int compare_double(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+// Nearest-rank percentile of sorted samples.
+static double percentile(const Tick_Times *sorted, double p) {
+    size_t rank = (size_t)(p / 100.0 * sorted->count + 0.5);
+    if (rank < 1) rank = 1;
+    if (rank > sorted->count) rank = sorted->count;
+    return sorted->items[rank - 1];
+}
+
+typedef struct {
+    int ticks;
+    int threads;
+    const char *scene; // NULL runs every scene
+    int size;          // 0 runs every size of bench_sizes
+} Bench_Config;
+
+static void usage(const char *program) {
+    fprintf(stderr, "Usage: %s [options]\n", program);
+    fprintf(stderr, "    -ticks <n>       ticks per run (default %d)\n", BENCH_TICKS_DEFAULT);
+    fprintf(stderr, "    -threads <n>     simulation threads, 0 for one per core (default 0)\n");
+    fprintf(stderr, "    -scene <name>    only run this scene\n");
+    fprintf(stderr, "    -size <n>        only run this grid size\n");
+    fprintf(stderr, "    -help            show this message\n");
+}
+
+static bool parse_int(const char *flag, const char *value, long min, long max, int *n) {
+    char *end;
+    long parsed = strtol(value, &end, 10);
+    if (end == value || *end != '\0' || parsed < min || parsed > max) {
+        nob_log(ERROR, "%s expects an integer in [%ld, %ld], got `%s`", flag, min, max, value);
+        return false;
+    }
+    *n = parsed;
+    return true;
+}
+
+static bool Bench_Config_parse_args(Bench_Config *config, int argc, char **argv) {
+    const char *program = shift(argv, argc);
+    while (argc > 0) {
+        const char *flag = shift(argv, argc);
+        if (strcmp(flag, "-help") == 0) {
+            usage(program);
+            exit(0);
+        }
+        if (argc == 0) {
+            nob_log(ERROR, "Unknown or incomplete option `%s`", flag);
+            usage(program);
+            return false;
+        }
+        const char *value = shift(argv, argc);
+        if (strcmp(flag, "-ticks") == 0) {
+            if (!parse_int(flag, value, 1, INT_MAX, &config->ticks)) return false;
+        } else if (strcmp(flag, "-threads") == 0) {
+            if (!parse_int(flag, value, 0, THREADS_MAX, &config->threads)) return false;
+        } else if (strcmp(flag, "-size") == 0) {
+            if (!parse_int(flag, value, 3, GRID_SIZE_MAX, &config->size)) return false;
+        } else if (strcmp(flag, "-scene") == 0) {
+            if (!Scene_find(value)) {
+                nob_log(ERROR, "Unknown scene `%s`", value);
+                return false;
+            }
+            config->scene = value;
+        } else {
+            nob_log(ERROR, "Unknown option `%s`", flag);
+            usage(program);
+            return false;
+        }
+    }
+    return true;
+}
+
+static void run_scene(const Scene *scene, int size, const Bench_Config *config, Worker_Pool *pool, Tick_Times *times, bool first) {
+    Grid grid = {0};
+    Grid_init(&grid, size, size, BENCH_SEED);
+    Rng rng;
+    Rng_seed(&rng, BENCH_SEED);
+    scene->setup(&grid, &rng);
+    Grid_wake(&grid, 0, 0, size - 1, size - 1);
+
+    times->count = 0;
+#ifdef SIM_COUNTERS
+    Sim_Counters total = {0};
+#endif
+#ifdef PERF
+    Perf_Counts sweep = {0}, passes[ACTIVE_TYPE_COUNT] = {0};
+#endif
+    uint64_t start = time_now_ns();
+    for (int tick = 0; tick < config->ticks; ++tick) {
+        Grid_tick(&grid, pool);
+        da_append(times, pool->stats.time_ms);
+#ifdef SIM_COUNTERS
+        const Sim_Counters *counters = &pool->stats.counters;
+        total.updates += counters->updates;
+        total.moves += counters->moves;
+        total.failed_moves += counters->failed_moves;
+        total.swaps += counters->swaps;
+        total.ignitions += counters->ignitions;
+        total.growths += counters->growths;
+        total.rng_draws += counters->rng_draws;
+#endif
+#ifdef PERF
+        Perf_Counts_add(&sweep, &pool->stats.perf_sweep, 1);
+        for (size_t i = 0; i < ACTIVE_TYPE_COUNT; ++i) Perf_Counts_add(&passes[i], &pool->stats.perf_pass[i], 1);
+#endif
+    }
+    double total_s = (time_now_ns() - start) / 1e9;
+    qsort(times->items, times->count, sizeof(*times->items), compare_double);
+
+    double cells = (double)size * size * config->ticks;
+    nob_log(INFO, "%-14s %4dx%-4d %8.1f ticks/s", scene->name, size, size, config->ticks / total_s);
+    printf("%s\n    {\"scene\": \"%s\", \"width\": %d, \"height\": %d, \"ticks\": %d, \"seconds\": %.6f, "
+           "\"ticks_per_sec\": %.2f, \"cells_per_sec\": %.0f, \"p50_ms\": %.4f, \"p99_ms\": %.4f",
+           first ? "" : ",", scene->name, size, size, config->ticks, total_s,
+           config->ticks / total_s, cells / total_s, percentile(times, 50), percentile(times, 99));
+#ifdef SIM_COUNTERS
+    // The counters slow the tick down, compare times only between builds with the same flags.
+    printf(", \"updates\": %"PRIu64", \"moves\": %"PRIu64", \"failed_moves\": %"PRIu64", \"failed_ratio\": %.4f, "
+           "\"swaps\": %"PRIu64", \"ignitions\": %"PRIu64", \"growths\": %"PRIu64", \"rng_draws\": %"PRIu64,
+           total.updates, total.moves, total.failed_moves, Sim_Counters_failed_ratio(&total),
+           total.swaps, total.ignitions, total.growths, total.rng_draws);
+#endif
+#ifdef PERF
+    // Per cell of the grid and tick, like cells_per_sec, whatever the type of the cell.
+    printf(",\n     \"perf\": {\"sweep\": ");
+    Perf_Counts_json(stdout, &sweep, cells);
+    for (size_t i = 0; i < ACTIVE_TYPE_COUNT; ++i) {
+        printf(",\n              \"%s\": ", Cell_Type_name_table[ACTIVE_TYPE_FIRST + i]);
+        Perf_Counts_json(stdout, &passes[i], cells);
+    }
+    printf("}");
+#endif
+    printf("}");
+    Grid_free(&grid);
+}
+
+int main(int argc, char **argv) {
+    Bench_Config config = { .ticks = BENCH_TICKS_DEFAULT };
+    if (!Bench_Config_parse_args(&config, argc, argv)) return 1;
+
+    Worker_Pool pool;
+    Worker_Pool_init(&pool, config.threads);
+    Tick_Times times = {0};
+
+    printf("{\n  \"seed\": %d,\n  \"threads\": %zu,\n  \"runs\": [", BENCH_SEED, pool.count);
+    bool first = true;
+    for (size_t i = 0; i < ARRAY_LEN(scenes); ++i) {
+        if (config.scene && strcmp(config.scene, scenes[i].name) != 0) continue;
+        for (size_t j = 0; j < ARRAY_LEN(bench_sizes); ++j) {
+            int size = config.size ? config.size : bench_sizes[j];
+            run_scene(&scenes[i], size, &config, &pool, &times, first);
+            first = false;
+            if (config.size) break;
+        }
+    }
+    printf("\n  ]\n}\n");
+
+    da_free(times);
+    Worker_Pool_free(&pool);
+#ifdef PERF
+    Perf_thread_stop();
+#endif
+    return 0;
+}
@@ -1,25 +1,60 @@
 #ifndef ECS_H_
 #define ECS_H_
 #include <stddef.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #ifndef NOB_H_
 #include "nob.h"
 #endif
 #define ecs_expand
 
+// Entity ids per page of the sparse index of a component.
+#define ECS_PAGE_SIZE 1024
+
+// Sparse set of the components of one type: the components are packed in `dense`, so
+// going over them touches only the entities that have one, and the sparse index maps an
+// entity id to its slot. The index is allocated a page of ids at a time, only for the
+// ranges of ids that have the component.
+typedef struct {
+    char *dense;          // `count` components of `size` bytes
+    size_t *entities;     // entity of each component in `dense`
+    size_t count, capacity, size;
+    uint32_t **pages;     // entity id -> slot in `dense` + 1, 0 for none
+    size_t page_count;
+} Sparse_Set;
+
+// Component of `entity`, NULL when it has none. Adding or removing components of the same
+// type may move it.
+void *Sparse_Set_get(const Sparse_Set *set, size_t entity);
+// Component of `entity`, made for it when it has none yet.
+void *Sparse_Set_put(Sparse_Set *set, size_t entity);
+// Moves the last component into the slot of the removed one. Returns false when there was none.
+bool Sparse_Set_remove(Sparse_Set *set, size_t entity);
+void Sparse_Set_free(Sparse_Set *set);
+
 #define Component(name, ...) \
     static size_t COMP_##name; \
     typedef struct __VA_ARGS__ name; \
-    static name name##_components[100]; \
+    static Sparse_Set name##_components = { .size = sizeof(name) }; \
     void register_##name() { if(COMP_##name == 0) COMP_##name = 1 << component_type_iota(); }\
-    name* get_##name(size_t id) { return &name##_components[id]; } \
+    name* get_##name(size_t id) { return Sparse_Set_get(&name##_components, id); } \
     void add_##name(size_t id, name value) { \
         if(COMP_##name == 0) {nob_log(NOB_ERROR, "Forgot to register `%s` componet first", #name); abort();}\
         entities.items[id].mask |= COMP_##name; \
-        name##_components[id] = value; \
+        *(name *)Sparse_Set_put(&name##_components, id) = value; \
+    } \
+    void remove_##name(size_t id) { \
+        entities.items[id].mask &= ~COMP_##name; \
+        Sparse_Set_remove(&name##_components, id); \
     }
 
+// Goes over every component of a type in memory order, ComponentEntity gives its entity.
+#define ForEachComponent(name, it) \
+    for (name *it = (name *)name##_components.dense; it < (name *)name##_components.dense + name##_components.count; ++it)
+#define ComponentEntity(name, it) (name##_components.entities[(it) - (name *)name##_components.dense])
+
 #define System(name) void name##_system
 #define QueryByComponents(e, ...) \
     nob_da_foreach(Entity, e, &entities) if(has_components(e->id, __VA_ARGS__))
@@ -68,6 +103,68 @@ static size_t component_type_iota() {
     return id++;
 }
 
+static uint32_t *Sparse_Set_slot(const Sparse_Set *set, size_t entity) {
+    size_t page = entity / ECS_PAGE_SIZE;
+    if (page >= set->page_count || !set->pages[page]) return NULL;
+    return &set->pages[page][entity % ECS_PAGE_SIZE];
+}
+
+void *Sparse_Set_get(const Sparse_Set *set, size_t entity) {
+    uint32_t *slot = Sparse_Set_slot(set, entity);
+    return slot && *slot ? set->dense + (*slot - 1) * set->size : NULL;
+}
+
+void *Sparse_Set_put(Sparse_Set *set, size_t entity) {
+    void *component = Sparse_Set_get(set, entity);
+    if (component) return component;
+
+    size_t page = entity / ECS_PAGE_SIZE;
+    if (page >= set->page_count) {
+        size_t page_count = set->page_count ? set->page_count : 1;
+        while (page_count <= page) page_count *= 2;
+        set->pages = realloc(set->pages, page_count * sizeof(*set->pages));
+        NOB_ASSERT(set->pages != NULL && "Buy more RAM lol");
+        memset(set->pages + set->page_count, 0, (page_count - set->page_count) * sizeof(*set->pages));
+        set->page_count = page_count;
+    }
+    if (!set->pages[page]) {
+        set->pages[page] = calloc(ECS_PAGE_SIZE, sizeof(*set->pages[page]));
+        NOB_ASSERT(set->pages[page] != NULL && "Buy more RAM lol");
+    }
+    if (set->count == set->capacity) {
+        set->capacity = set->capacity ? set->capacity * 2 : 64;
+        set->dense = realloc(set->dense, set->capacity * set->size);
+        set->entities = realloc(set->entities, set->capacity * sizeof(*set->entities));
+        NOB_ASSERT(set->dense != NULL && set->entities != NULL && "Buy more RAM lol");
+    }
+    NOB_ASSERT(set->count < UINT32_MAX && "Sparse_Set_put");
+    set->entities[set->count] = entity;
+    set->pages[page][entity % ECS_PAGE_SIZE] = ++set->count;
+    return memset(set->dense + (set->count - 1) * set->size, 0, set->size);
+}
+
+bool Sparse_Set_remove(Sparse_Set *set, size_t entity) {
+    uint32_t *slot = Sparse_Set_slot(set, entity);
+    if (!slot || !*slot) return false;
+    size_t index = *slot - 1, last = set->count - 1;
+    if (index != last) {
+        memcpy(set->dense + index * set->size, set->dense + last * set->size, set->size);
+        set->entities[index] = set->entities[last];
+        *Sparse_Set_slot(set, set->entities[index]) = index + 1;
+    }
+    *slot = 0;
+    set->count--;
+    return true;
+}
+
+void Sparse_Set_free(Sparse_Set *set) {
+    for (size_t i = 0; i < set->page_count; ++i) free(set->pages[i]);
+    free(set->pages);
+    free(set->dense);
+    free(set->entities);
+    *set = (Sparse_Set) { .size = set->size };
+}
+
 #endif // ECS_IMPLEMENTATION
 
 #endif // ECS_H_
@@ -0,0 +1,208 @@
+#ifndef FRAMES_H_
+#define FRAMES_H_
+// Exports frames of the grid as RGB images without a window. Define FRAMES_IMPLEMENTATION
+// in exactly one translation unit before including this file.
+#include "sim.h"
+
+typedef enum {
+    FRAME_FORMAT_PPM, // binary PPM: one file per frame when the path has a `%d`, otherwise concatenated
+    FRAME_FORMAT_RAW, // bare rgb24 frames, concatenated, e.g. for `ffmpeg -f rawvideo -pix_fmt rgb24`
+} Frame_Format;
+
+// Frames waiting to be written. When the writer falls this far behind, a lossy writer drops
+// new frames instead of making the simulation wait for the disk, other writers wait for a slot.
+#define FRAME_QUEUE_SIZE 8
+
+typedef struct {
+    uint8_t *types; // width * height copy of the type plane
+    size_t index;   // frame number, counting from 0
+} Frame;
+
+// The simulation only copies the type plane into a free slot. Expanding it to RGB and
+// all file I/O happen on the writer thread.
+typedef struct {
+    Frame_Format format;
+    const char *path; // file, printf pattern with one %d for a PPM sequence, or "-" for stdout
+    FILE *stream;     // when everything goes to a single stream
+    int width, height;
+    bool lossy;
+    uint8_t *rgb;     // width * height * 3, owned by the writer thread
+
+    Frame slots[FRAME_QUEUE_SIZE];
+    size_t head, tail; // slots[head % FRAME_QUEUE_SIZE] is filled next, slots[tail % ...] written next
+    size_t submitted, dropped;
+    bool failed;
+
+    pthread_mutex_t mutex;
+    pthread_cond_t ready; // a frame was queued, or the writer is done
+    pthread_cond_t freed; // a slot was written
+    bool done;
+    pthread_t thread;
+} Frame_Writer;
+
+bool Frame_Format_parse(const char *name, Frame_Format *format);
+bool Frame_Writer_start(Frame_Writer *writer, const char *path, Frame_Format format, int width, int height, bool lossy);
+// Queues a frame of the grid, called between ticks. Only copies the type plane, and only
+// waits when the queue is full and the writer is not lossy. Loads the chunks the grid has yet to.
+void Frame_Writer_submit(Frame_Writer *writer, Grid *grid);
+// Writes the queued frames and stops the writer. Returns false if any frame failed.
+bool Frame_Writer_finish(Frame_Writer *writer);
+
+#ifdef FRAMES_IMPLEMENTATION
+
+bool Frame_Format_parse(const char *name, Frame_Format *format) {
+    if (strcmp(name, "ppm") == 0) {
+        *format = FRAME_FORMAT_PPM;
+    } else if (strcmp(name, "raw") == 0) {
+        *format = FRAME_FORMAT_RAW;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+static bool Frame_Writer_is_sequence(const Frame_Writer *writer) {
+    return writer->format == FRAME_FORMAT_PPM && strchr(writer->path, '%') != NULL;
+}
+
+static bool Frame_Writer_write(Frame_Writer *writer, const Frame *frame) {
+    size_t cells = (size_t)writer->width * writer->height;
+    uint8_t *rgb = writer->rgb;
+    for (size_t i = 0; i < cells; ++i, rgb += 3) {
+        Rgb color = Cell_Type_color_table[frame->types[i] < NOB_ARRAY_LEN(Cell_Type_color_table) ? frame->types[i] : CELL_TYPE_NONE];
+        rgb[0] = color.r;
+        rgb[1] = color.g;
+        rgb[2] = color.b;
+    }
+
+    FILE *stream = writer->stream;
+    char path[4096];
+    if (Frame_Writer_is_sequence(writer)) {
+        snprintf(path, sizeof(path), writer->path, (int)frame->index);
+        stream = fopen(path, "wb");
+        if (!stream) {
+            nob_log(NOB_ERROR, "Could not open %s: %s", path, strerror(errno));
+            return false;
+        }
+    }
+
+    bool ok = true;
+    if (writer->format == FRAME_FORMAT_PPM) ok = fprintf(stream, "P6\n%d %d\n255\n", writer->width, writer->height) > 0;
+    ok = ok && fwrite(writer->rgb, 3, cells, stream) == cells;
+    if (stream != writer->stream) ok = fclose(stream) == 0 && ok;
+    if (!ok) nob_log(NOB_ERROR, "Could not write frame %zu to %s: %s", frame->index, writer->path, strerror(errno));
+    return ok;
+}
+
+static void *Frame_Writer_main(void *arg) {
+    Frame_Writer *writer = arg;
+#ifdef TRACE
+    Trace_thread("frame writer");
+#endif
+    pthread_mutex_lock(&writer->mutex);
+    for (;;) {
+        while (!writer->done && writer->head == writer->tail) pthread_cond_wait(&writer->ready, &writer->mutex);
+        if (writer->head == writer->tail) break;
+        Frame *frame = &writer->slots[writer->tail % FRAME_QUEUE_SIZE];
+        pthread_mutex_unlock(&writer->mutex);
+
+        bool ok;
+        TRACE_SCOPE("write frame", frame->index) {
+            ok = Frame_Writer_write(writer, frame);
+        }
+
+        pthread_mutex_lock(&writer->mutex);
+        writer->failed |= !ok;
+        writer->tail++;
+        pthread_cond_signal(&writer->freed);
+    }
+    pthread_mutex_unlock(&writer->mutex);
+    return NULL;
+}
+
+bool Frame_Writer_start(Frame_Writer *writer, const char *path, Frame_Format format, int width, int height, bool lossy) {
+    *writer = (Frame_Writer) {
+        .format = format,
+        .path = path,
+        .width = width,
+        .height = height,
+        .lossy = lossy,
+    };
+    if (strcmp(path, "-") == 0) {
+        writer->stream = stdout;
+    } else if (!Frame_Writer_is_sequence(writer)) {
+        writer->stream = fopen(path, "wb");
+        if (!writer->stream) {
+            nob_log(NOB_ERROR, "Could not open %s: %s", path, strerror(errno));
+            return false;
+        }
+    }
+
+    size_t cells = (size_t)width * height;
+    writer->rgb = malloc(cells * 3);
+    unwrap_null(writer->rgb);
+    for (size_t i = 0; i < FRAME_QUEUE_SIZE; ++i) {
+        writer->slots[i].types = malloc(cells);
+        unwrap_null(writer->slots[i].types);
+    }
+    pthread_mutex_init(&writer->mutex, NULL);
+    pthread_cond_init(&writer->ready, NULL);
+    pthread_cond_init(&writer->freed, NULL);
+    if (pthread_create(&writer->thread, NULL, Frame_Writer_main, writer) != 0) {
+        nob_log(NOB_ERROR, "Could not start the frame writer thread");
+        return false;
+    }
+    return true;
+}
+
+void Frame_Writer_submit(Frame_Writer *writer, Grid *grid) {
+    Grid_load_all(grid);
+    pthread_mutex_lock(&writer->mutex);
+    while (!writer->lossy && writer->head - writer->tail == FRAME_QUEUE_SIZE) pthread_cond_wait(&writer->freed, &writer->mutex);
+    bool full = writer->head - writer->tail == FRAME_QUEUE_SIZE;
+    Frame *frame = &writer->slots[writer->head % FRAME_QUEUE_SIZE];
+    pthread_mutex_unlock(&writer->mutex);
+
+    size_t index = writer->submitted++;
+    if (full) {
+        writer->dropped++;
+        return;
+    }
+    // The slot at head is never touched by the writer thread until head moves past it.
+    frame->index = index;
+    for (int row = 0; row < grid->height; ++row) {
+        memcpy(&frame->types[(size_t)row * grid->width], &grid->types[Grid_index(grid, 0, row)], grid->width);
+    }
+
+    pthread_mutex_lock(&writer->mutex);
+    writer->head++;
+    pthread_cond_signal(&writer->ready);
+    pthread_mutex_unlock(&writer->mutex);
+}
+
+bool Frame_Writer_finish(Frame_Writer *writer) {
+    pthread_mutex_lock(&writer->mutex);
+    writer->done = true;
+    pthread_cond_signal(&writer->ready);
+    pthread_mutex_unlock(&writer->mutex);
+    pthread_join(writer->thread, NULL);
+
+    bool ok = !writer->failed;
+    if (writer->stream && writer->stream != stdout) ok = fclose(writer->stream) == 0 && ok;
+    else if (writer->stream) ok = fflush(writer->stream) == 0 && ok;
+    if (writer->dropped > 0) {
+        nob_log(NOB_WARNING, "Dropped %zu of %zu frames, the disk could not keep up", writer->dropped, writer->submitted);
+    }
+
+    pthread_mutex_destroy(&writer->mutex);
+    pthread_cond_destroy(&writer->ready);
+    pthread_cond_destroy(&writer->freed);
+    for (size_t i = 0; i < FRAME_QUEUE_SIZE; ++i) free(writer->slots[i].types);
+    free(writer->rgb);
+    *writer = (Frame_Writer) {0};
+    return ok;
+}
+
+#endif // FRAMES_IMPLEMENTATION
+
+#endif // FRAMES_H_
@@ -5,445 +5,1225 @@
 #define ECS_IMPLEMENTATION
 #include "ecs.h"
 
-// Extending nob_da_foreach idea
-#define da_foreach_rev(Type, it, da) for (Type *it = (da)->items+(da)->count-1; it > (da)->items; --it)
-#define unwrap_null(x) NOB_ASSERT(x && "unwrap null pointer")
+#define TRACE_IMPLEMENTATION
+#include "trace.h"
+
+#define PERF_IMPLEMENTATION
+#include "perf.h"
+
+#define SIM_IMPLEMENTATION
+#include "sim.h"
+
+#define SCENES_IMPLEMENTATION
+#include "scenes.h"
+
+#define FRAMES_IMPLEMENTATION
+#include "frames.h"
+
+#define REPLAY_IMPLEMENTATION
+#include "replay.h"
+
+#define WORLD_IMPLEMENTATION
+#include "world.h"
+
+#define JOURNAL_IMPLEMENTATION
+#include "journal.h"
+
+#define PAGER_IMPLEMENTATION
+#include "pager.h"
+
+#define IMPORT_IMPLEMENTATION
+#include "import.h"
+
+#define PROFILE_IMPLEMENTATION
+#include "profile.h"
+
+#include <inttypes.h>
+#include <math.h>
 
 #include "raylib.h"
 
 // Display Config
-#define GRID_MULT 32
-
-#define GRID_SIZE (1 * GRID_MULT)
-#define CELL_SIZE (960 / GRID_MULT)
-#define WINDOW_WIDTH (GRID_SIZE * CELL_SIZE)
-#define UI_OFFSET 30
-#define WINDOW_HEIGHT (GRID_SIZE * CELL_SIZE + UI_OFFSET)
+#define VIEW_SIZE 960
+#define WINDOW_WIDTH VIEW_SIZE
+// Lines of statistics under the controls, one row of small text each.
+#ifdef PROFILE
+#define UI_PROFILE_LINES 2
+#else
+#define UI_PROFILE_LINES 0
+#endif
+#ifdef SIM_COUNTERS
+#define UI_COUNTER_LINES 2
+#else
+#define UI_COUNTER_LINES 0
+#endif
+#define UI_LINE_HEIGHT 12
+#define UI_OFFSET (30 + UI_LINE_HEIGHT * (UI_PROFILE_LINES + UI_COUNTER_LINES))
+#define WINDOW_HEIGHT (VIEW_SIZE + UI_OFFSET)
 #define MOUSEHITBOX 1.0f
 
+// Grid Config
+#define GRID_SIZE_DEFAULT 32
+
 #define SIMULATION_SPEED_BASE 1
+#define SIMULATION_TICK_RATE_DEFAULT 60
+#define HEADLESS_TICKS_DEFAULT 1000
+#define JOURNAL_EVERY_DEFAULT 60
+#define TARGET_FPS 60
+// How often the tick statistics in the UI bar are refreshed.
+#define UI_STATS_PERIOD 0.5
+// Where F2 dumps the profile of every frame, when built with PROFILE.
+#define PROFILE_CSV_PATH "profile.csv"
+// Where F5 saves the world.
+#define WORLD_SAVE_PATH "world.sbw"
 
 // Colors
-#define BACKGROUND_COLOR DARKGRAY
-
-typedef enum {
-    CELL_TYPE_NONE,
-    CELL_TYPE_SAND,
-    CELL_TYPE_WATER,
-    CELL_TYPE_OIL,
-    CELL_TYPE_LIFE,
-    CELL_TYPE_SEED,
-    CELL_TYPE_FIRE,
-    CELL_TYPE_ROCK,
-    CELL_TYPE_BEDROCK,
-} Cell_Type;
-
-static_assert(CELL_TYPE_NONE  == 0, "Cell_Type has change");
-static Color Cell_Type_color_table[] = {
-    [CELL_TYPE_BEDROCK] = GRAY,
-    [CELL_TYPE_ROCK] = GRAY,
-    [CELL_TYPE_WATER] = BLUE,
-    [CELL_TYPE_LIFE] = GREEN,
-    [CELL_TYPE_SEED] = DARKGREEN,
-    [CELL_TYPE_SAND] = BEIGE,
-    [CELL_TYPE_FIRE] = ORANGE,
-    [CELL_TYPE_NONE] = BACKGROUND_COLOR,
-    [CELL_TYPE_OIL] = BROWN,
-};
-static_assert(ARRAY_LEN(Cell_Type_color_table) == 9, "Cell_Type has change");
-
-static_assert(CELL_TYPE_NONE  == 0, "Cell_Type has change");
-static bool Cell_Type_flamable_table[] = {
-    [CELL_TYPE_LIFE] = true,
-    [CELL_TYPE_SEED] = true,
-    [CELL_TYPE_OIL] = true,
-    [CELL_TYPE_WATER] = false,
-    [CELL_TYPE_BEDROCK] = false,
-    [CELL_TYPE_ROCK] = false,
-    [CELL_TYPE_SAND] = false,
-    [CELL_TYPE_FIRE] = false,
-    [CELL_TYPE_NONE] = false,
-};
-static_assert(ARRAY_LEN(Cell_Type_color_table) == 9, "Cell_Type has change");
+#define BACKGROUND_COLOR DARKGRAY // same as CELL_TYPE_NONE
 
+// Camera over the grid: the cell at the top left corner of the view and the on-screen
+// size of a cell in pixels. The view is never zoomed out past the whole grid.
 typedef struct {
-    Rectangle rect;
-    bool updated;
-    Cell_Type type;
-} Cell;
+    float x, y;
+    float zoom;
+    float min_zoom, max_zoom;
+    int grid_width, grid_height;
+} View;
+
+#define VIEW_ZOOM_MAX 64.0f
+#define VIEW_ZOOM_STEP 1.25f
+#define VIEW_PAN_SPEED 600.0f // pixels per second with the arrow keys
+
+static inline float View_cells(const View *view) {
+    return VIEW_SIZE / view->zoom;
+}
 
-static inline Color Cell_get_color(Cell *c) {
-    NOB_ASSERT((c->type >= CELL_TYPE_NONE && c->type < ARRAY_LEN(Cell_Type_color_table)) && "Cell_get_color");
-    return Cell_Type_color_table[c->type];
+// Keeps the grid on screen, centered along an axis when it is smaller than the view.
+static void View_clamp(View *view) {
+    if (view->zoom < view->min_zoom) view->zoom = view->min_zoom;
+    if (view->zoom > view->max_zoom) view->zoom = view->max_zoom;
+    float cells = View_cells(view);
+    float *pos[] = { &view->x, &view->y };
+    int size[] = { view->grid_width, view->grid_height };
+    for (size_t i = 0; i < ARRAY_LEN(pos); ++i) {
+        if (size[i] <= cells) *pos[i] = (size[i] - cells) / 2;
+        else if (*pos[i] < 0) *pos[i] = 0;
+        else if (*pos[i] > size[i] - cells) *pos[i] = size[i] - cells;
+    }
 }
 
-typedef struct {
-    Cell* items;
-    size_t capacity, count;
-} Grid;
+void View_reset(View *view) {
+    view->zoom = view->min_zoom;
+    View_clamp(view);
+}
 
-static inline Cell* Grid_get_cell(Grid *grid, size_t pos) {
-    if(pos < grid->count) return &grid->items[pos];
-    // unwrap_null(NULL);
-    return NULL;
+void View_init(View *view, int grid_width, int grid_height) {
+    *view = (View) {
+        .grid_width = grid_width,
+        .grid_height = grid_height,
+        .min_zoom = (float)VIEW_SIZE / (grid_width > grid_height ? grid_width : grid_height),
+        .max_zoom = VIEW_ZOOM_MAX,
+    };
+    if (view->max_zoom < view->min_zoom) view->max_zoom = view->min_zoom;
+    View_reset(view);
 }
 
-void UpdateSand(Grid*grid, Cell*c, int col, int row);
-void UpdateWater(Grid*grid, Cell*c, int col, int row);
-void UpdateOil(Grid*grid, Cell*c, int col, int row);
-void UpdateLife(Grid*grid, Cell*c, int col, int row);
-void UpdateSeed(Grid*grid, Cell*c, int col, int row);
-void UpdateFire(Grid*grid, Cell*c, int col, int row);
-bool SwapCell(Grid *grid, size_t src_pos, size_t dst_pos);
-bool TryMoveCell(Grid *grid, size_t src_pos, size_t dst_pos, Cell_Type allowed_type);
-int CountNeighbors(Grid *grid, int col, int row, Cell_Type type);
-bool HasNeighbor(Grid *grid, int col, int row, Cell_Type type);
-void UpdateMouseRect(Grid* grid);
-bool TryUpdateSeed(Grid*grid, Cell*c, size_t pos);
-
-typedef void (*CellUpdateFn)(Grid*, Cell*, int, int);
-static CellUpdateFn update_table[] = {
-    [CELL_TYPE_NONE] = NULL,
-    [CELL_TYPE_SAND] = UpdateSand,
-    [CELL_TYPE_WATER] = UpdateWater,
-    [CELL_TYPE_OIL] = UpdateOil,
-    [CELL_TYPE_LIFE] = UpdateLife,
-    [CELL_TYPE_SEED] = UpdateSeed,
-    [CELL_TYPE_FIRE] = UpdateFire,
-    [CELL_TYPE_ROCK] = NULL,
-    [CELL_TYPE_BEDROCK] = NULL,
-};
-static_assert(ARRAY_LEN(update_table) == 9, "update_table has change");
+static inline Vector2 View_to_cell(const View *view, Vector2 screen) {
+    return (Vector2) { view->x + screen.x / view->zoom, view->y + (screen.y - UI_OFFSET) / view->zoom };
+}
 
-static inline void Grid_update(Grid*grid, Cell*c) {
-    if (update_table[c->type]) {
-        int col = c->rect.x / (int)CELL_SIZE;
-        int row = (c->rect.y - UI_OFFSET) / (int)CELL_SIZE;
-        update_table[c->type](grid, c, col, row);
-    }
+static inline Rectangle View_cell_rect(const View *view, int col, int row) {
+    return (Rectangle) {
+        .x = (col - view->x) * view->zoom,
+        .y = (row - view->y) * view->zoom + UI_OFFSET,
+        .width = view->zoom,
+        .height = view->zoom,
+    };
 }
 
-static Cell_Type curr_place_type;
+// Zooms by `factor`, keeping the cell under `screen` in place.
+void View_zoom_at(View *view, float factor, Vector2 screen) {
+    Vector2 anchor = View_to_cell(view, screen);
+    view->zoom *= factor;
+    if (view->zoom < view->min_zoom) view->zoom = view->min_zoom;
+    if (view->zoom > view->max_zoom) view->zoom = view->max_zoom;
+    view->x = anchor.x - screen.x / view->zoom;
+    view->y = anchor.y - (screen.y - UI_OFFSET) / view->zoom;
+    View_clamp(view);
+}
 
-static Rectangle mouse_rect = (Rectangle) {
-    .width = MOUSEHITBOX,
-    .height = MOUSEHITBOX,
-};
+// Moves the view by a distance in pixels.
+void View_pan(View *view, float dx, float dy) {
+    view->x += dx / view->zoom;
+    view->y += dy / view->zoom;
+    View_clamp(view);
+}
 
-int main(void) {
-    InitWindow(WINDOW_WIDTH, WINDOW_HEIGHT, "SandBox");
-    SetTargetFPS(60);
+// The visible part of the grid is expanded through a palette covering all 256 byte values,
+// so the lookup needs no bounds check, into a texture the size of the view and drawn as a
+// single quad. At most one texel per pixel is ever expanded, reading from the mip level
+// where a cell is no smaller than a pixel, which the simulation builds for the view into
+// the snapshot, so the cost depends on the view and not on the grid. Only as many levels
+// are used as it takes for the whole grid to fit the view. The texture is only refilled
+// when the view moved or the snapshot's texels changed.
+#define VIEW_TEXELS (VIEW_SIZE + 2) // a partially visible texel on both sides
+// Snapshots widen the view to whole chunks on both sides.
+#define SNAPSHOT_TEXELS (VIEW_TEXELS + 2 * CHUNK_SIZE)
 
-    Grid grid = {0};
-    char * legend = temp_sprintf("%dx%d Grid", GRID_SIZE, GRID_SIZE);
-    char * controls = "Simulation: P | (-/+) / Elements: Q | W | S | R | E | F | T ";
-    size_t frameCounter = 0;
-    size_t simulationSpeed = SIMULATION_SPEED_BASE;
-    bool simulationPaused = false;
-
-    for (int row = 0; row < GRID_SIZE; row++) {
-        for (int col = 0; col < GRID_SIZE; col++) {
-            Cell cell = (Cell) {
-                .rect = (Rectangle) {
-                    .x = col * (int)CELL_SIZE,
-                    .y = row * (int)CELL_SIZE + UI_OFFSET,
-                    .width = (int)CELL_SIZE,
-                    .height = (int)CELL_SIZE,
-                },
-                .type = (row == 0 || col == 0) || (row == GRID_SIZE-1 || col == GRID_SIZE-1)  ? CELL_TYPE_BEDROCK : CELL_TYPE_NONE,
-            };
-            da_append(&grid, cell);
+typedef struct {
+    Texture2D texture;
+    Color *pixels;       // staging for the texture
+    Color palette[256];
+    int width, height;
+    int level_count;
+
+    uint64_t content;    // of the snapshot of the last fill
+    View filled;         // view of the last fill
+    bool has_filled;
+    Rectangle source, dest;
+} Renderer;
+
+void Renderer_init(Renderer *renderer, int width, int height) {
+    *renderer = (Renderer) {
+        .width = width,
+        .height = height,
+        .level_count = 1,
+    };
+    renderer->pixels = malloc((size_t)VIEW_TEXELS * VIEW_TEXELS * sizeof(*renderer->pixels));
+    unwrap_null(renderer->pixels);
+    for (size_t i = 0; i < ARRAY_LEN(renderer->palette); ++i) {
+        if (i < ARRAY_LEN(Cell_Type_color_table)) {
+            Rgb rgb = Cell_Type_color_table[i];
+            renderer->palette[i] = (Color) { rgb.r, rgb.g, rgb.b, 255 };
+        } else {
+            renderer->palette[i] = MAGENTA;
         }
     }
-
-    while (!WindowShouldClose()) {
-        if(IsKeyDown(KEY_Q)) curr_place_type = CELL_TYPE_NONE;
-        if(IsKeyDown(KEY_W)) curr_place_type = CELL_TYPE_WATER;
-        if(IsKeyDown(KEY_S)) curr_place_type = CELL_TYPE_SAND;
-        if(IsKeyDown(KEY_R)) curr_place_type = CELL_TYPE_ROCK;
-        if(IsKeyDown(KEY_E)) curr_place_type = CELL_TYPE_SEED;
-        if(IsKeyDown(KEY_F)) curr_place_type = CELL_TYPE_FIRE;
-        if(IsKeyDown(KEY_T)) curr_place_type = CELL_TYPE_OIL;
-        if(IsKeyPressed(KEY_P)) simulationPaused = !simulationPaused;
-        if(IsKeyPressed(KEY_EQUAL)) simulationSpeed = (simulationSpeed > SIMULATION_SPEED_BASE ? simulationSpeed - 1 : SIMULATION_SPEED_BASE);
-        if(IsKeyPressed(KEY_MINUS)) simulationSpeed++;
-
-        if(IsMouseButtonDown(MOUSE_LEFT_BUTTON)) UpdateMouseRect(&grid);
-
-        if(!simulationPaused) frameCounter++;
-        if (frameCounter >= simulationSpeed) {
-            frameCounter = 0;
-            da_foreach_rev(Cell, c, &grid) {
-                if(c->updated) continue;
-                Grid_update(&grid, c);
-            }
-        }
-
-        BeginDrawing();
-
-        ClearBackground(BACKGROUND_COLOR);
-
-        DrawText(legend, 10, 10, 20, WHITE);
-        DrawText(controls, 140, 10, 20, WHITE);
-
-        da_foreach(Cell, it, &grid) {
-            it->updated = false;
-
-            Color c = Cell_get_color(it);
-
-            DrawRectangleRec(it->rect, c);
-        }
-
-        DrawRectangleLines(0, UI_OFFSET, WINDOW_WIDTH, GRID_SIZE * CELL_SIZE, BLACK);
-
-        EndDrawing();
+    while (((width - 1) >> (renderer->level_count - 1)) + 1 > VIEW_SIZE ||
+           ((height - 1) >> (renderer->level_count - 1)) + 1 > VIEW_SIZE) {
+        renderer->level_count++;
     }
 
-    da_free(grid);
+    Image image = GenImageColor(VIEW_TEXELS, VIEW_TEXELS, BACKGROUND_COLOR);
+    renderer->texture = LoadTextureFromImage(image);
+    UnloadImage(image);
+}
 
-    CloseWindow();
+void Renderer_free(Renderer *renderer) {
+    UnloadTexture(renderer->texture);
+    free(renderer->pixels);
+    *renderer = (Renderer) {0};
+}
 
-    return 0;
+// The part of the grid inside the view and the level to draw it at, for the simulation
+// to build the next snapshots from.
+Snapshot_View Renderer_view(const Renderer *renderer, const View *view) {
+    float cells = View_cells(view);
+    int k = 0;
+    while (k + 1 < renderer->level_count && view->zoom * (1 << k) < 1.0f) ++k;
+    int max_x = ceilf(view->x + cells) - 1, max_y = ceilf(view->y + cells) - 1;
+    return (Snapshot_View) {
+        .level = k,
+        .min_x = view->x > 0 ? view->x : 0,
+        .min_y = view->y > 0 ? view->y : 0,
+        .max_x = max_x < renderer->width ? max_x : renderer->width - 1,
+        .max_y = max_y < renderer->height ? max_y : renderer->height - 1,
+    };
 }
 
-void UpdateMouseRect(Grid* grid) {
-    Vector2 mouse_pos = GetMousePosition();
-    mouse_rect.x = mouse_pos.x;
-    mouse_rect.y = mouse_pos.y;
+// Refills the texture with the part of the grid inside the view, from the texels of the
+// snapshot, which may still be of the previous view. Returns false when the view did not
+// move and the snapshot's texels did not change since the last fill.
+bool Renderer_prepare(Renderer *renderer, const Snapshot *snapshot, const View *view) {
+    bool moved = !renderer->has_filled || renderer->filled.x != view->x || renderer->filled.y != view->y ||
+                 renderer->filled.zoom != view->zoom;
+    if (!moved && snapshot->content == renderer->content) return false;
+    renderer->filled = *view;
+    renderer->has_filled = true;
+    renderer->content = snapshot->content;
+
+    float cells = View_cells(view);
+    float min_x = view->x > 0 ? view->x : 0;
+    float min_y = view->y > 0 ? view->y : 0;
+    float max_x = view->x + cells < renderer->width ? view->x + cells : renderer->width;
+    float max_y = view->y + cells < renderer->height ? view->y + cells : renderer->height;
+
+    float scale = 1 << snapshot->level;
+    int tx0 = min_x / scale, ty0 = min_y / scale;
+    int tx1 = ceilf(max_x / scale), ty1 = ceilf(max_y / scale);
+    if (tx0 < snapshot->x0) tx0 = snapshot->x0;
+    if (ty0 < snapshot->y0) ty0 = snapshot->y0;
+    if (tx1 > snapshot->x1) tx1 = snapshot->x1;
+    if (ty1 > snapshot->y1) ty1 = snapshot->y1;
+    if (tx1 - tx0 > VIEW_TEXELS) tx1 = tx0 + VIEW_TEXELS;
+    if (ty1 - ty0 > VIEW_TEXELS) ty1 = ty0 + VIEW_TEXELS;
+    if (tx1 <= tx0 || ty1 <= ty0) {
+        renderer->source = renderer->dest = (Rectangle) {0};
+        return true;
+    }
+    int width = tx1 - tx0, height = ty1 - ty0, stride = snapshot->x1 - snapshot->x0;
 
-    int col = mouse_rect.x / (int)CELL_SIZE;
-    int row = (mouse_rect.y - UI_OFFSET) / (int)CELL_SIZE;
+    const Color *palette = renderer->palette;
+    Color *pixels = renderer->pixels;
+    for (int y = ty0; y < ty1; ++y, pixels += width) {
+        const uint8_t *types = &snapshot->types[(size_t)(y - snapshot->y0) * stride + (tx0 - snapshot->x0)];
+        for (int x = 0; x < width; ++x) pixels[x] = palette[types[x]];
+    }
+    UpdateTextureRec(renderer->texture, (Rectangle) { 0, 0, width, height }, renderer->pixels);
+
+    // The cells the texels cover, all of the view unless the snapshot lags behind it.
+    if (min_x < tx0 * scale) min_x = tx0 * scale;
+    if (min_y < ty0 * scale) min_y = ty0 * scale;
+    if (max_x > tx1 * scale) max_x = tx1 * scale;
+    if (max_y > ty1 * scale) max_y = ty1 * scale;
+    renderer->source = (Rectangle) {
+        min_x / scale - tx0, min_y / scale - ty0, (max_x - min_x) / scale, (max_y - min_y) / scale,
+    };
+    renderer->dest = (Rectangle) {
+        (min_x - view->x) * view->zoom, (min_y - view->y) * view->zoom + UI_OFFSET,
+        (max_x - min_x) * view->zoom, (max_y - min_y) * view->zoom,
+    };
+    return true;
+}
 
-    size_t pos = col + row * GRID_SIZE;
-    if(pos >= grid->count) return;
-    Cell *c = Grid_get_cell(grid, pos);
-    unwrap_null(c);
-    if(c->type == CELL_TYPE_BEDROCK) return;
-    if(CheckCollisionRecs(c->rect, mouse_rect)) c->type = curr_place_type;
+void Renderer_draw(const Renderer *renderer) {
+    DrawTexturePro(renderer->texture, renderer->source, renderer->dest, (Vector2) {0}, 0, WHITE);
 }
 
-bool SwapCell(Grid *grid, size_t src_pos, size_t dst_pos) {
-    if (dst_pos >= grid->count) return false;
+typedef struct {
+    int grid_width, grid_height;
+    int threads; // 0 means one per core
+    int tick_rate; // ticks per second at base speed, 0 for as fast as possible
+    uint64_t seed;
+    const Scene *scene; // starting world, NULL for an empty one
+    const char *world_path; // saved world to start from instead of a scene, NULL for none
+    const char *recover_path; // journal to start from instead of a scene, NULL for none
+    const char *image_path; // image to start from instead of a scene, NULL for none
+    Import_Image image;     // loaded from `image_path` by main, sets the size of the grid
+
+    bool headless;     // run `ticks` ticks without a window, as fast as possible
+    int ticks;
+    const char *export_path; // NULL when frames are not exported
+    Frame_Format export_format;
+    int export_every;  // ticks between exported frames
+    const char *trace_path; // NULL when not tracing
+    const char *record_path; // NULL when the input is not recorded
+    const char *replay_path; // NULL unless replaying a recording
+    const char *save_path;   // where a headless run saves the world at the end, NULL for nowhere
+    const char *journal_path; // where the world is journaled as it runs, NULL for nowhere
+    int journal_every;        // ticks between journal records
+    const char *page_path;    // file the planes of the grid are paged to, NULL to keep them in memory
+} Config;
+
+// Creates the grid of the config, in memory or paged to a file.
+static bool Config_init_grid(const Config *config, Grid *grid) {
+    if (!config->page_path) {
+        Grid_init(grid, config->grid_width, config->grid_height, config->seed);
+        return true;
+    }
+    return Grid_init_paged(grid, config->grid_width, config->grid_height, config->seed, config->page_path);
+}
 
-    Cell *src = &grid->items[src_pos];
-    Cell *dst = &grid->items[dst_pos];
+// Logs how much of a paged grid is in memory.
+static void Pager_log(const Pager *pager, const Grid *grid) {
+    nob_log(NOB_INFO, "Paged out %.1f MB over %zu scans, %.1f of %.1f MB of the grid in memory",
+            pager->paged_out / 1e6, pager->scans, Pager_resident(pager, grid) / 1e6, grid->mapping_size / 1e6);
+}
 
-    Cell_Type tmp = src->type;
-    src->type = dst->type;
-    dst->type = tmp;
+static bool Config_fill_world(const Config *config, Grid *grid) {
+    if (config->image.rgb) {
+        uint64_t start = time_now_ns();
+        Import_image(grid, &config->image);
+        nob_log(NOB_INFO, "Imported %s in %.1f ms", config->image_path, (time_now_ns() - start) / 1e6);
+        return true;
+    }
+    if (config->recover_path) {
+        Journal_File journal;
+        if (!Journal_File_open(&journal, config->recover_path)) return false;
+        bool ok = Journal_File_recover(&journal, grid);
+        Journal_File_close(&journal);
+        return ok;
+    }
+    if (config->world_path) {
+        uint64_t start = time_now_ns();
+        World_File world;
+        if (!World_File_open(&world, config->world_path)) return false;
+        bool ok = World_File_attach(&world, grid);
+        if (ok) nob_log(NOB_INFO, "Loaded %s in %.1f ms", config->world_path, (time_now_ns() - start) / 1e6);
+        return ok;
+    }
+    Rng rng;
+    Rng_seed(&rng, config->seed);
+    config->scene->setup(grid, &rng);
+    return true;
+}
 
-    src->updated = true;
-    dst->updated = true;
+// Fills the grid and wakes it up for the first tick. An empty grid stays asleep, and a
+// saved world wakes the chunks that were awake when it was saved.
+static bool Config_setup_world(const Config *config, Grid *grid) {
+    if (!config->image.rgb && !config->recover_path && !config->world_path && !config->scene) return true;
+    if (!Config_fill_world(config, grid)) return false;
+    if (!config->world_path) Grid_wake(grid, 0, 0, grid->width - 1, grid->height - 1);
     return true;
 }
 
-bool TryMoveCell(Grid *grid, size_t src_pos, size_t dst_pos, Cell_Type allowed_type) {
-    if (dst_pos >= grid->count) return false;
+typedef struct {
+    int col, row;
+    Cell_Type type;
+} Edit;
 
-    Cell *src = Grid_get_cell(grid, src_pos);
-    Cell *dst = Grid_get_cell(grid, dst_pos);
+typedef struct {
+    Edit *items;
+    size_t count;
+    size_t capacity;
+} Edits;
+
+// Runs the simulation on its own thread, so a slow tick never drops a frame and the frame
+// rate never caps the tick rate. The main thread only queues edits and controls, and reads
+// the world back through the snapshot buffer.
+typedef struct {
+    Grid grid;
+    Worker_Pool pool;
+    Snapshot_Buffer snapshots;
+    uint64_t tick_period_ns; // at base speed
+    Frame_Writer *writer;    // gets a frame every `export_every` ticks, or NULL
+    Replay_Recorder *recorder; // gets every edit, or NULL
+    Journal *journal;        // gets a record every `journal_every` ticks, or NULL
+    Pager pager;             // when the grid is paged
+    int export_every;
+    int journal_every;
+    size_t ticks;
+    pthread_t thread;
+
+    // Shared with the main thread, under `mutex`.
+    pthread_mutex_t mutex;
+    pthread_cond_t wake;
+    Edits edits; // applied before the next tick
+    Snapshot_View view; // of the snapshots to publish
+    bool view_changed;
+    bool save;   // saves the world to WORLD_SAVE_PATH before the next tick
+    bool paused;
+    size_t speed; // a tick every `speed` tick periods
+    bool quit;
+} Sim;
+
+#ifdef PROFILE
+static Profile profile;
+#endif
+
+#ifdef PERF
+// Hardware counters of the whole run, logged at exit. The simulation side is only written
+// by the thread that ticks and the render side by the main thread, both read once they stopped.
+static struct {
+    Perf_Counts sweep, pass[ACTIVE_TYPE_COUNT];
+    uint64_t cells;  // grid cells times ticks
+    Perf_Counts render;
+    uint64_t texels; // view texels times frames
+} perf;
+
+static void perf_record_tick(const Grid *grid, const Tick_Stats *stats) {
+    Perf_Counts_add(&perf.sweep, &stats->perf_sweep, 1);
+    for (size_t i = 0; i < ACTIVE_TYPE_COUNT; ++i) Perf_Counts_add(&perf.pass[i], &stats->perf_pass[i], 1);
+    perf.cells += (uint64_t)grid->width * grid->height;
+}
 
-    if (dst->type == allowed_type) {
-        dst->type = src->type;
-        dst->updated = true;
-        src->type = CELL_TYPE_NONE;
-        src->updated = true;
-        return true;
+static void perf_log(void) {
+    nob_log(NOB_INFO, "Hardware counters, per cell of the grid and tick, or of the view and frame:");
+    Perf_Counts_log("sweep", &perf.sweep, perf.cells);
+    for (size_t i = 0; i < ACTIVE_TYPE_COUNT; ++i) {
+        Perf_Counts_log(Cell_Type_name_table[ACTIVE_TYPE_FIRST + i], &perf.pass[i], perf.cells);
     }
-    return false;
+    if (perf.texels) Perf_Counts_log("render", &perf.render, perf.texels);
+}
+#endif
+
+static void Grid_apply_edit(Grid *grid, int col, int row, Cell_Type type) {
+    Grid_load_chunk(grid, col / CHUNK_SIZE + row / CHUNK_SIZE * grid->chunks_x);
+    size_t pos = Grid_index(grid, col, row);
+    if (grid->types[pos] == CELL_TYPE_BEDROCK) return;
+    Grid_set_type(grid, pos, type);
+    Grid_mark_dirty(grid, col, row);
 }
 
-void UpdateSand(Grid*grid, Cell*c, int col, int row) {
-    c->updated = true;
-    size_t pos = col + row * GRID_SIZE;
+static void Sim_apply_edits(Sim *sim, const Edits *edits) {
+    da_foreach(Edit, edit, edits) {
+        Grid_apply_edit(&sim->grid, edit->col, edit->row, edit->type);
+        if (sim->recorder) {
+            Replay_Recorder_edit(sim->recorder, (Replay_Edit) {
+                .tick = sim->ticks,
+                .col = edit->col,
+                .row = edit->row,
+                .type = edit->type,
+            });
+        }
+    }
+}
 
-    size_t down = col + (row+1) * GRID_SIZE;
-    if (TryMoveCell(grid, pos, down, CELL_TYPE_NONE)) return;
-    int side = GetRandomValue(0, 1) ? -1 : 1;
-    size_t down_side = (col+(side)) + (row+1) * GRID_SIZE;
-    if (TryMoveCell(grid, pos, down_side, CELL_TYPE_NONE)) return;
+static void *Sim_main(void *arg) {
+    Sim *sim = arg;
+#ifdef TRACE
+    Trace_thread("simulation");
+#endif
+    Edits edits = {0};
+    uint64_t next_tick = time_now_ns();
+
+    pthread_mutex_lock(&sim->mutex);
+    for (;;) {
+        while (!sim->quit && sim->edits.count == 0 && !sim->view_changed && !sim->save &&
+               (sim->paused || time_now_ns() < next_tick)) {
+            if (sim->paused) {
+                pthread_cond_wait(&sim->wake, &sim->mutex);
+            } else {
+                struct timespec deadline = { .tv_sec = next_tick / 1000000000, .tv_nsec = next_tick % 1000000000 };
+                pthread_cond_timedwait(&sim->wake, &sim->mutex, &deadline);
+            }
+        }
+        if (sim->quit) break;
+
+        Edits queued = sim->edits;
+        sim->edits = edits;
+        edits = queued;
+        bool tick = !sim->paused && time_now_ns() >= next_tick;
+        uint64_t period = sim->speed * sim->tick_period_ns;
+        Snapshot_View view = sim->view;
+        sim->view_changed = false;
+        bool save = sim->save;
+        sim->save = false;
+        pthread_mutex_unlock(&sim->mutex);
+
+        Sim_apply_edits(sim, &edits);
+        edits.count = 0;
+        if (save) {
+            World_save(WORLD_SAVE_PATH, &sim->grid);
+        }
+        if (tick) {
+            Grid_tick(&sim->grid, &sim->pool);
+#ifdef PROFILE
+            Profile_record_tick(&profile, &sim->pool.stats);
+#endif
+#ifdef PERF
+            perf_record_tick(&sim->grid, &sim->pool.stats);
+#endif
+            sim->ticks++;
+            if (sim->writer && sim->ticks % sim->export_every == 0) Frame_Writer_submit(sim->writer, &sim->grid);
+            if (sim->journal && sim->ticks % sim->journal_every == 0) {
+                TRACE_SCOPE("journal", TRACE_NO_ID) Journal_sync(sim->journal, &sim->grid, sim->ticks);
+            }
+            if (sim->grid.mapping && sim->ticks % PAGER_SCAN_TICKS == 0) {
+                TRACE_SCOPE("page out", TRACE_NO_ID) Pager_scan(&sim->pager, &sim->grid);
+            }
+            // A tick that overran its period delays the next one instead of piling them up.
+            uint64_t now = time_now_ns();
+            next_tick = next_tick + period > now ? next_tick + period : now;
+        }
+        PROFILE_SCOPE(&profile, PROFILE_ZONE_PUBLISH) {
+            Snapshot_Buffer_publish(&sim->snapshots, &sim->grid, &view, &sim->pool.stats);
+        }
 
-    if (row < GRID_SIZE - 1) {
-        size_t down = col + (row+1) * GRID_SIZE;
-        if (grid->items[down].type == CELL_TYPE_WATER && SwapCell(grid, pos, down)) return;
-        if (grid->items[down].type == CELL_TYPE_OIL && SwapCell(grid, pos, down)) return;
+        pthread_mutex_lock(&sim->mutex);
     }
+    pthread_mutex_unlock(&sim->mutex);
+    // Edits made while paused are only journaled here.
+    if (sim->journal) Journal_finish(sim->journal, &sim->grid, sim->ticks);
+    da_free(edits);
+#ifdef PERF
+    // Worker 0 ran on this thread, its counters close with it.
+    Perf_thread_stop();
+#endif
+    return NULL;
 }
 
-void UpdateOil(Grid*grid, Cell*c, int col, int row) {
-    c->updated = true;
-    size_t pos = col + row * GRID_SIZE;
-    size_t down = col + (row+1) * GRID_SIZE;
-    size_t top = col + (row-1) * GRID_SIZE;
+void Sim_init(Sim *sim, const Config *config, Frame_Writer *writer, Replay_Recorder *recorder, Journal *journal) {
+    *sim = (Sim) {
+        .tick_period_ns = config->tick_rate ? 1000000000ull / config->tick_rate : 0,
+        .writer = writer,
+        .recorder = recorder,
+        .journal = journal,
+        .export_every = config->export_every,
+        .journal_every = config->journal_every,
+        .speed = SIMULATION_SPEED_BASE,
+    };
+    if (!Config_init_grid(config, &sim->grid) || !Config_setup_world(config, &sim->grid)) exit(1);
+    if (sim->grid.mapping) Pager_init(&sim->pager, &sim->grid);
+    if (writer) Frame_Writer_submit(writer, &sim->grid);
+    if (journal && !Journal_start(journal, config->journal_path, &sim->grid, 0)) exit(1);
+    Worker_Pool_init(&sim->pool, config->threads);
+    // The whole grid until the window tells what it shows.
+    sim->view = (Snapshot_View) { .max_x = sim->grid.width - 1, .max_y = sim->grid.height - 1 };
+    while (((sim->grid.width - 1) >> sim->view.level) + 1 > VIEW_SIZE || ((sim->grid.height - 1) >> sim->view.level) + 1 > VIEW_SIZE) {
+        sim->view.level++;
+    }
+    Snapshot_Buffer_init(&sim->snapshots, &sim->grid, SNAPSHOT_TEXELS);
+    Snapshot_Buffer_publish(&sim->snapshots, &sim->grid, &sim->view, &sim->pool.stats);
+
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&sim->wake, &attr);
+    pthread_condattr_destroy(&attr);
+    pthread_mutex_init(&sim->mutex, NULL);
+    if (pthread_create(&sim->thread, NULL, Sim_main, sim) != 0) {
+        nob_log(NOB_ERROR, "Could not start the simulation thread");
+        exit(1);
+    }
+}
 
-    if (TryMoveCell(grid, pos, down, CELL_TYPE_NONE)) return;
+void Sim_free(Sim *sim) {
+    pthread_mutex_lock(&sim->mutex);
+    sim->quit = true;
+    pthread_cond_signal(&sim->wake);
+    pthread_mutex_unlock(&sim->mutex);
+    pthread_join(sim->thread, NULL);
+
+    pthread_mutex_destroy(&sim->mutex);
+    pthread_cond_destroy(&sim->wake);
+    da_free(sim->edits);
+    if (sim->grid.mapping) {
+        Pager_log(&sim->pager, &sim->grid);
+        Pager_free(&sim->pager);
+    }
+    Snapshot_Buffer_free(&sim->snapshots);
+    Worker_Pool_free(&sim->pool);
+    Grid_free(&sim->grid);
+}
 
-    int dir = GetRandomValue(0, 1) == 0 ? -1 : 1;
-    size_t side = (col+dir) + row * GRID_SIZE;
-    if (TryMoveCell(grid, pos, side, CELL_TYPE_NONE)) return;
+void Sim_push_edit(Sim *sim, Edit edit) {
+    pthread_mutex_lock(&sim->mutex);
+    da_append(&sim->edits, edit);
+    pthread_cond_signal(&sim->wake);
+    pthread_mutex_unlock(&sim->mutex);
+}
 
-    dir = GetRandomValue(0, 1) == 0 ? -1 : 1;
-    size_t down_side = (col+dir) + (row+1) * GRID_SIZE;
-    if (TryMoveCell(grid, pos, down_side,  CELL_TYPE_NONE)) return;
+// Asks for snapshots of another part of the grid, published right away even when paused.
+void Sim_set_view(Sim *sim, Snapshot_View view) {
+    pthread_mutex_lock(&sim->mutex);
+    if (memcmp(&view, &sim->view, sizeof(view)) != 0) {
+        sim->view = view;
+        sim->view_changed = true;
+        pthread_cond_signal(&sim->wake);
+    }
+    pthread_mutex_unlock(&sim->mutex);
+}
 
-    if (grid->items[top].type == CELL_TYPE_WATER && SwapCell(grid, pos, top)) return;
-    if (grid->items[top].type == CELL_TYPE_SAND && SwapCell(grid, pos, top)) return;
+void Sim_request_save(Sim *sim) {
+    pthread_mutex_lock(&sim->mutex);
+    sim->save = true;
+    pthread_cond_signal(&sim->wake);
+    pthread_mutex_unlock(&sim->mutex);
 }
 
-void UpdateFire(Grid*grid, Cell*c, int col, int row) {
-    c->updated = true;
-    size_t pos = col + row * GRID_SIZE;
-    size_t down = col + (row+1) * GRID_SIZE;
-    size_t top = col + (row-1) * GRID_SIZE;
-    size_t left = (col-1) + row * GRID_SIZE;
-    size_t right = (col+1) + row * GRID_SIZE;
+void Sim_toggle_pause(Sim *sim) {
+    pthread_mutex_lock(&sim->mutex);
+    sim->paused = !sim->paused;
+    pthread_cond_signal(&sim->wake);
+    pthread_mutex_unlock(&sim->mutex);
+}
 
-    int dir = GetRandomValue(0, 1) == 0 ? -1 : 1;
-    size_t side = (col+dir) + row * GRID_SIZE;
+// Positive `delta` slows the simulation down, negative speeds it up to the base speed.
+void Sim_change_speed(Sim *sim, int delta) {
+    pthread_mutex_lock(&sim->mutex);
+    if (delta > 0 || sim->speed > SIMULATION_SPEED_BASE) sim->speed += delta;
+    pthread_mutex_unlock(&sim->mutex);
+}
 
-    dir = GetRandomValue(0, 1) == 0 ? -1 : 1;
-    size_t down_side = (col+dir) + (row+1) * GRID_SIZE;
+void UpdateMouseRect(Sim *sim, const View *view);
 
-    if(Cell_Type_flamable_table[grid->items[top].type] && SwapCell(grid, pos, top)) {
-        c->type = CELL_TYPE_NONE;
-        return;
-    }
-    if(Cell_Type_flamable_table[grid->items[down].type] && SwapCell(grid, pos, down)) {
-        c->type = CELL_TYPE_NONE;
-        TryMoveCell(grid, pos, down, CELL_TYPE_NONE);
-        return;
+static bool Config_parse_int(String_View key, String_View value, long min, long max, long *n) {
+    const char *value_cstr = temp_sv_to_cstr(value);
+    char *end;
+    *n = strtol(value_cstr, &end, 10);
+    if (*end != '\0' || *n < min || *n > max) {
+        nob_log(NOB_ERROR, "Invalid value `%s` for `"SV_Fmt"`, expected an integer in [%ld, %ld]", value_cstr, SV_Arg(key), min, max);
+        return false;
     }
-    if(Cell_Type_flamable_table[grid->items[left].type] && SwapCell(grid, pos, left)) {
-        c->type = CELL_TYPE_NONE;
-        TryMoveCell(grid, pos, left, CELL_TYPE_NONE);
-        return;
-    }
-    if(Cell_Type_flamable_table[grid->items[right].type] && SwapCell(grid, pos, right)) {
-        c->type = CELL_TYPE_NONE;
-        TryMoveCell(grid, pos, right, CELL_TYPE_NONE);
-        return;
-    }
-    if(Cell_Type_flamable_table[grid->items[side].type] && SwapCell(grid, pos, side)) {
-        c->type = CELL_TYPE_NONE;
-        TryMoveCell(grid, pos, side, CELL_TYPE_NONE);
-        return;
-    }
-    if(Cell_Type_flamable_table[grid->items[down_side].type] && SwapCell(grid, pos, down_side)) {
-        c->type = CELL_TYPE_NONE;
-        TryMoveCell(grid, pos, down_side,  CELL_TYPE_NONE);
-        return;
-    }
-    if (TryMoveCell(grid, pos, down, CELL_TYPE_NONE)) return;
-    c->type = CELL_TYPE_NONE;
+    return true;
 }
 
-bool TryUpdateSeed(Grid *grid, Cell *c, size_t pos) {
-    if (pos >= grid->count) return false;
-    Cell *other = Grid_get_cell(grid, pos);
-    if (other->type == CELL_TYPE_WATER) {
-        other->type = CELL_TYPE_LIFE;
-        other->updated = true;
-        c->type = CELL_TYPE_NONE;
-        return true;
+static bool Config_set(Config *config, String_View key, String_View value) {
+    long n;
+    if (sv_eq(key, sv_from_cstr("width"))) {
+        if (!Config_parse_int(key, value, 3, GRID_PAGED_SIZE_MAX, &n)) return false;
+        config->grid_width = n;
+    } else if (sv_eq(key, sv_from_cstr("height"))) {
+        if (!Config_parse_int(key, value, 3, GRID_PAGED_SIZE_MAX, &n)) return false;
+        config->grid_height = n;
+    } else if (sv_eq(key, sv_from_cstr("size"))) {
+        if (!Config_parse_int(key, value, 3, GRID_PAGED_SIZE_MAX, &n)) return false;
+        config->grid_width = n;
+        config->grid_height = n;
+    } else if (sv_eq(key, sv_from_cstr("seed"))) {
+        if (!Config_parse_int(key, value, 0, LONG_MAX, &n)) return false;
+        config->seed = n;
+    } else if (sv_eq(key, sv_from_cstr("tps"))) {
+        if (!Config_parse_int(key, value, 0, 1000000, &n)) return false;
+        config->tick_rate = n;
+    } else if (sv_eq(key, sv_from_cstr("scene"))) {
+        config->scene = Scene_find(temp_sv_to_cstr(value));
+        if (!config->scene) {
+            nob_log(NOB_ERROR, "Unknown scene `"SV_Fmt"`", SV_Arg(value));
+            return false;
+        }
+    } else if (sv_eq(key, sv_from_cstr("headless"))) {
+        if (!Config_parse_int(key, value, 0, 1, &n)) return false;
+        config->headless = n;
+    } else if (sv_eq(key, sv_from_cstr("ticks"))) {
+        if (!Config_parse_int(key, value, 0, INT_MAX, &n)) return false;
+        config->ticks = n;
+    } else if (sv_eq(key, sv_from_cstr("export"))) {
+        config->export_path = strndup(value.data, value.count);
+        unwrap_null(config->export_path);
+    } else if (sv_eq(key, sv_from_cstr("export_format"))) {
+        if (!Frame_Format_parse(temp_sv_to_cstr(value), &config->export_format)) {
+            nob_log(NOB_ERROR, "Unknown export format `"SV_Fmt"`, expected `ppm` or `raw`", SV_Arg(value));
+            return false;
+        }
+    } else if (sv_eq(key, sv_from_cstr("trace"))) {
+#ifdef TRACE
+        config->trace_path = strndup(value.data, value.count);
+        unwrap_null(config->trace_path);
+#else
+        nob_log(NOB_ERROR, "Tracing is not compiled in, build with `./nob profile`");
+        return false;
+#endif
+    } else if (sv_eq(key, sv_from_cstr("world"))) {
+        config->world_path = strndup(value.data, value.count);
+        unwrap_null(config->world_path);
+    } else if (sv_eq(key, sv_from_cstr("save"))) {
+        config->save_path = strndup(value.data, value.count);
+        unwrap_null(config->save_path);
+    } else if (sv_eq(key, sv_from_cstr("recover"))) {
+        config->recover_path = strndup(value.data, value.count);
+        unwrap_null(config->recover_path);
+    } else if (sv_eq(key, sv_from_cstr("journal"))) {
+        config->journal_path = strndup(value.data, value.count);
+        unwrap_null(config->journal_path);
+    } else if (sv_eq(key, sv_from_cstr("journal_every"))) {
+        if (!Config_parse_int(key, value, 1, INT_MAX, &n)) return false;
+        config->journal_every = n;
+    } else if (sv_eq(key, sv_from_cstr("image"))) {
+        config->image_path = strndup(value.data, value.count);
+        unwrap_null(config->image_path);
+    } else if (sv_eq(key, sv_from_cstr("page"))) {
+        config->page_path = strndup(value.data, value.count);
+        unwrap_null(config->page_path);
+    } else if (sv_eq(key, sv_from_cstr("record"))) {
+        config->record_path = strndup(value.data, value.count);
+        unwrap_null(config->record_path);
+    } else if (sv_eq(key, sv_from_cstr("replay"))) {
+        config->replay_path = strndup(value.data, value.count);
+        unwrap_null(config->replay_path);
+    } else if (sv_eq(key, sv_from_cstr("export_every"))) {
+        if (!Config_parse_int(key, value, 1, INT_MAX, &n)) return false;
+        config->export_every = n;
+    } else if (sv_eq(key, sv_from_cstr("threads"))) {
+        if (!Config_parse_int(key, value, 0, THREADS_MAX, &n)) return false;
+        config->threads = n;
+    } else {
+        nob_log(NOB_ERROR, "Unknown config key `"SV_Fmt"`", SV_Arg(key));
+        return false;
     }
-    return false;
+    return true;
 }
 
-void UpdateSeed(Grid*grid, Cell*c, int col, int row) {
-    c->updated = true;
-    size_t pos = col + row * GRID_SIZE;
-
-    size_t down = col + (row+1) * GRID_SIZE;
-    if (TryUpdateSeed(grid, c, down)) return;
-    if (TryMoveCell(grid, pos, down, CELL_TYPE_NONE)) return;
+// Config files hold one `key = value` per line, `#` starts a comment.
+static bool Config_load_file(Config *config, const char *path) {
+    String_Builder sb = {0};
+    bool result = true;
+    if (!read_entire_file(path, &sb)) return_defer(false);
+
+    String_View content = sb_to_sv(sb);
+    for (size_t line_number = 1; content.count > 0; ++line_number) {
+        String_View line = sv_chop_by_delim(&content, '\n');
+        line = sv_trim(sv_chop_by_delim(&line, '#'));
+        if (line.count == 0) continue;
+
+        String_View key = sv_trim(sv_chop_by_delim(&line, '='));
+        String_View value = sv_trim(line);
+        if (value.count == 0) {
+            nob_log(NOB_ERROR, "%s:%zu: expected `key = value`", path, line_number);
+            return_defer(false);
+        }
+        if (!Config_set(config, key, value)) return_defer(false);
+    }
 
-    int side = GetRandomValue(0, 1) ? -1 : 1;
-    size_t down_side = (col+(side)) + (row+1) * GRID_SIZE;
-    if (TryUpdateSeed(grid, c, down_side)) return;
-    if (TryMoveCell(grid, pos, down_side, CELL_TYPE_NONE)) return;
-    size_t top = col + (row-1) * GRID_SIZE;
-    if (TryUpdateSeed(grid, c, top)) return;
+defer:
+    sb_free(sb);
+    return result;
 }
 
-void UpdateWater(Grid*grid, Cell*c, int col, int row) {
-    c->updated = true;
-    size_t pos = col + row * GRID_SIZE;
-    size_t down = col + (row+1) * GRID_SIZE;
-    size_t top = col + (row-1) * GRID_SIZE;
+static void usage(const char *program) {
+    fprintf(stderr, "Usage: %s [options]\n", program);
+    fprintf(stderr, "    -width <n>       grid width in cells (default %d, max %d, or %d with -page)\n", GRID_SIZE_DEFAULT, GRID_SIZE_MAX, GRID_PAGED_SIZE_MAX);
+    fprintf(stderr, "    -height <n>      grid height in cells (default %d, max %d, or %d with -page)\n", GRID_SIZE_DEFAULT, GRID_SIZE_MAX, GRID_PAGED_SIZE_MAX);
+    fprintf(stderr, "    -size <n>        grid width and height in cells\n");
+    fprintf(stderr, "    -threads <n>     simulation threads, 0 for one per core (default 0)\n");
+    fprintf(stderr, "    -tps <n>         simulation ticks per second, 0 for as fast as possible (default %d)\n", SIMULATION_TICK_RATE_DEFAULT);
+    fprintf(stderr, "    -seed <n>        random seed, runs with the same seed and input are identical (default: time)\n");
+    fprintf(stderr, "    -scene <name>    start from a built-in scene, e.g. flood or seed_forest\n");
+    fprintf(stderr, "    -world <path>    start from a saved world, with its size and seed\n");
+    fprintf(stderr, "    -image <path>    start from an image, PPM or anything raylib loads, one cell per pixel\n");
+    fprintf(stderr, "    -save <path>     save the world at the end of a headless run, F5 saves a window's\n");
+    fprintf(stderr, "    -journal <path>  autosave the world as it runs, only writing the chunks that changed\n");
+    fprintf(stderr, "    -journal_every <n> ticks between journal records (default %d)\n", JOURNAL_EVERY_DEFAULT);
+    fprintf(stderr, "    -recover <path>  start from the last state in a journal, with its size and seed\n");
+    fprintf(stderr, "    -page <path>     keep the grid in a file on disk and drop the chunks that stay asleep from memory\n");
+    fprintf(stderr, "    -headless 1      run without a window for -ticks ticks (default %d)\n", HEADLESS_TICKS_DEFAULT);
+    fprintf(stderr, "    -export <path>   write frames to a file, a `%%06d.ppm` pattern, or - for stdout\n");
+    fprintf(stderr, "    -export_format   ppm or raw rgb24 (default ppm)\n");
+    fprintf(stderr, "    -export_every <n> ticks between exported frames (default 1)\n");
+    fprintf(stderr, "    -trace <path>    write a timeline of the run as Chrome trace-event JSON, with ./nob profile\n");
+    fprintf(stderr, "    -record <path>   record the seed, the world and every placed cell for -replay\n");
+    fprintf(stderr, "    -replay <path>   replay a recording headless as fast as possible, ignores the world options\n");
+    fprintf(stderr, "    -config <path>   read `key = value` options from a file\n");
+}
 
-    if (TryMoveCell(grid, pos, down, CELL_TYPE_NONE)) return;
+// Options are applied in order, so later ones override earlier ones.
+static bool Config_parse_args(Config *config, int argc, char **argv) {
+    const char *program = shift(argv, argc);
+    while (argc > 0) {
+        const char *flag = shift(argv, argc);
+        if (strcmp(flag, "-help") == 0) {
+            usage(program);
+            exit(0);
+        }
+        if (argc == 0) {
+            usage(program);
+            nob_log(NOB_ERROR, "Missing value for `%s`", flag);
+            return false;
+        }
+        const char *value = shift(argv, argc);
+        if (strcmp(flag, "-config") == 0) {
+            if (!Config_load_file(config, value)) return false;
+        } else if (flag[0] == '-') {
+            if (!Config_set(config, sv_from_cstr(flag + 1), sv_from_cstr(value))) return false;
+        } else {
+            usage(program);
+            nob_log(NOB_ERROR, "Unexpected argument `%s`", flag);
+            return false;
+        }
+    }
+    return true;
+}
 
-    int dir = GetRandomValue(0, 1) == 0 ? -1 : 1;
-    size_t side = (col+dir) + row * GRID_SIZE;
-    if (TryMoveCell(grid, pos, side, CELL_TYPE_NONE)) return;
+// Runs the simulation as fast as possible without opening a window, feeding the edits of
+// `replay` in before the ticks they were recorded before when there is one.
+static bool run_headless(const Config *config, Frame_Writer *writer, Replay *replay) {
+    bool result = true;
+    Grid grid = {0};
+    Worker_Pool pool;
+    Pager pager = {0};
+    Journal journal = {0};
+    bool pooled = false, journaling = false;
+    if (!Config_init_grid(config, &grid)) return_defer(false);
+    Worker_Pool_init(&pool, config->threads);
+    pooled = true;
+    if (!Config_setup_world(config, &grid)) return_defer(false);
+    if (grid.mapping) Pager_init(&pager, &grid);
+    if (writer) Frame_Writer_submit(writer, &grid);
+    if (config->journal_path) {
+        journaling = true;
+        if (!Journal_start(&journal, config->journal_path, &grid, 0)) return_defer(false);
+    }
 
-    dir = GetRandomValue(0, 1) == 0 ? -1 : 1;
-    size_t down_side = (col+dir) + (row+1) * GRID_SIZE;
-    if (TryMoveCell(grid, pos, down_side,  CELL_TYPE_NONE)) return;
+    Replay_Edit edit;
+    bool pending = replay && Replay_next(replay, &edit);
+    uint64_t start = time_now_ns();
+    for (int tick = 1; tick <= config->ticks; ++tick) {
+        for (; pending && edit.tick < (uint64_t)tick; pending = Replay_next(replay, &edit)) {
+            Grid_apply_edit(&grid, edit.col, edit.row, edit.type);
+        }
+        Grid_tick(&grid, &pool);
+#ifdef PROFILE
+        Profile_record_tick(&profile, &pool.stats);
+#endif
+#ifdef PERF
+        perf_record_tick(&grid, &pool.stats);
+#endif
+        if (writer && tick % config->export_every == 0) Frame_Writer_submit(writer, &grid);
+        if (journaling && tick % config->journal_every == 0) {
+            TRACE_SCOPE("journal", TRACE_NO_ID) Journal_sync(&journal, &grid, tick);
+        }
+        if (grid.mapping && tick % PAGER_SCAN_TICKS == 0) {
+            TRACE_SCOPE("page out", TRACE_NO_ID) Pager_scan(&pager, &grid);
+        }
+    }
+    double seconds = (time_now_ns() - start) / 1e9;
+    nob_log(NOB_INFO, "%d ticks of a %dx%d grid in %.2fs (%.1f ticks/s)",
+            config->ticks, grid.width, grid.height, seconds, config->ticks / seconds);
+#ifdef PROFILE
+    for (Profile_Zone zone = PROFILE_ZONE_TICK; zone < PROFILE_ZONE_COUNT; ++zone) {
+        if (zone == PROFILE_ZONE_PUBLISH) continue;
+        Profile_Summary summary = Profile_summarize(&profile, zone);
+        nob_log(NOB_INFO, "    %-8s avg %.3f ms, p99 %.3f ms over the last %d ticks", Profile_Zone_names[zone],
+                summary.avg_ms, summary.p99_ms, config->ticks < PROFILE_HISTORY ? config->ticks : PROFILE_HISTORY);
+    }
+#endif
+#ifdef PERF
+    perf_log();
+    Perf_thread_stop();
+#endif
+    if (grid.mapping) Pager_log(&pager, &grid);
+    if (config->save_path) {
+        result = World_save(config->save_path, &grid);
+    }
 
-    if (grid->items[top].type == CELL_TYPE_SAND && SwapCell(grid, pos, top)) return;
+defer:
+    // Whatever failed, the threads are joined and the files closed.
+    if (writer) result = Frame_Writer_finish(writer) && result;
+    if (journaling) result = Journal_finish(&journal, &grid, config->ticks) && result;
+    if (pooled) Worker_Pool_free(&pool);
+#ifdef TRACE
+    if (config->trace_path) result = Trace_write(config->trace_path) && result;
+#endif
+    if (grid.mapping) Pager_free(&pager);
+    Grid_free(&grid);
+    return result;
 }
 
-int CountNeighbors(Grid *grid, int col, int row, Cell_Type type) {
-    int count = 0;
-    if (row > 0) { size_t top = col + (row-1) * GRID_SIZE; if(grid->items[top].type == type) count++; }
-    if (col > 0) { size_t left = (col-1) + row * GRID_SIZE; if(grid->items[left].type == type) count++; }
-    if (col > 0 &&
-        row < GRID_SIZE - 1) { size_t down_left = (col+1) + (row-1) * GRID_SIZE; if(grid->items[down_left].type == type) count++; }
-    if (row < GRID_SIZE - 1) { size_t down = col + (row+1) * GRID_SIZE; if(grid->items[down].type == type) count++; }
-    if (col < GRID_SIZE - 1) { size_t right = (col+1) + row * GRID_SIZE; if(grid->items[right].type == type) count++; }
-    if (col < GRID_SIZE - 1) { size_t down_right = (col+1) + (row+1) * GRID_SIZE; if(grid->items[down_right].type == type) count++; }
-    return count;
+#ifdef PROFILE
+// Formats the rolling statistics of the zones [first, end) for the UI bar.
+static void format_profile(char *buf, size_t size, Profile_Zone first, Profile_Zone end, const char *suffix) {
+    int n = 0;
+    for (Profile_Zone zone = first; zone < end && n >= 0 && (size_t)n < size; ++zone) {
+        Profile_Summary summary = Profile_summarize(&profile, zone);
+        n += snprintf(buf + n, size - n, "%s %.2f/%.2f  ", Profile_Zone_names[zone], summary.avg_ms, summary.p99_ms);
+    }
+    if (n >= 0 && (size_t)n < size) snprintf(buf + n, size - n, "%s", suffix);
 }
-
-bool HasNeighbor(Grid *grid, int col, int row, Cell_Type type) {
-    if (row > 0)               { size_t top    = col     + (row-1) * GRID_SIZE; if (grid->items[top].type == type) return true; }
-    if (row < GRID_SIZE - 1)   { size_t down   = col     + (row+1) * GRID_SIZE; if (grid->items[down].type == type) return true; }
-    if (col > 0)               { size_t left   = (col-1) + row * GRID_SIZE;     if (grid->items[left].type == type) return true; }
-    if (col < GRID_SIZE - 1)   { size_t right  = (col+1) + row * GRID_SIZE;     if (grid->items[right].type == type) return true; }
-    return false;
+#endif
+
+#ifdef SIM_COUNTERS
+// Formats what the rules did in the last tick and the population of every type.
+static void format_counters(char lines[2][256], const Snapshot *snapshot) {
+    const Sim_Counters *counters = &snapshot->stats.counters;
+    snprintf(lines[0], sizeof(lines[0]),
+             "last tick: %"PRIu64" updates, %"PRIu64" moves, %"PRIu64" failed (%.0f%%), %"PRIu64" swaps, "
+             "%"PRIu64" ignitions, %"PRIu64" growths, %"PRIu64" random draws",
+             counters->updates, counters->moves, counters->failed_moves, Sim_Counters_failed_ratio(counters) * 100,
+             counters->swaps, counters->ignitions, counters->growths, counters->rng_draws);
+    int n = snprintf(lines[1], sizeof(lines[1]), "population:");
+    for (Cell_Type type = CELL_TYPE_SAND; type < CELL_TYPE_BEDROCK && n >= 0 && (size_t)n < sizeof(lines[1]); ++type) {
+        n += snprintf(lines[1] + n, sizeof(lines[1]) - n, "  %s %"PRIu64, Cell_Type_name_table[type], snapshot->population[type]);
+    }
+}
+#endif
+
+// Reads a PPM itself and any other format through raylib, as 8-bit RGB.
+static bool load_image(Import_Image *image, const char *path) {
+    if (sv_end_with(sv_from_cstr(path), ".ppm")) return Import_load_ppm(image, path);
+    Image loaded = LoadImage(path);
+    if (!loaded.data) {
+        nob_log(NOB_ERROR, "Could not load the image %s", path);
+        return false;
+    }
+    ImageFormat(&loaded, PIXELFORMAT_UNCOMPRESSED_R8G8B8);
+    size_t size = (size_t)loaded.width * loaded.height * 3;
+    *image = (Import_Image) { .rgb = malloc(size), .width = loaded.width, .height = loaded.height };
+    unwrap_null(image->rgb);
+    memcpy(image->rgb, loaded.data, size);
+    UnloadImage(loaded);
+    return true;
 }
 
-void UpdateLife(Grid*grid, Cell*c, int col, int row) {
-    c->updated = true;
+static Cell_Type curr_place_type;
 
-    size_t candidates[4];
-    int count = 0;
+static Rectangle mouse_rect = (Rectangle) {
+    .width = MOUSEHITBOX,
+    .height = MOUSEHITBOX,
+};
 
-    if (row > 0) {
-        size_t top = col + (row-1) * GRID_SIZE;
-        if (grid->items[top].type == CELL_TYPE_NONE && HasNeighbor(grid, col, row-1, CELL_TYPE_WATER)) {
-            candidates[count++] = top;
+int main(int argc, char **argv) {
+    Config config = {
+        .grid_width = GRID_SIZE_DEFAULT,
+        .grid_height = GRID_SIZE_DEFAULT,
+        .tick_rate = SIMULATION_TICK_RATE_DEFAULT,
+        .seed = time(NULL),
+        .ticks = HEADLESS_TICKS_DEFAULT,
+        .export_format = FRAME_FORMAT_PPM,
+        .export_every = 1,
+        .journal_every = JOURNAL_EVERY_DEFAULT,
+    };
+    if (!Config_parse_args(&config, argc, argv)) return 1;
+
+    Replay replay = {0};
+    if (config.replay_path) {
+        if (!Replay_load(&replay, config.replay_path)) return 1;
+        config.grid_width = replay.header.width;
+        config.grid_height = replay.header.height;
+        config.seed = replay.header.seed;
+        config.scene = NULL;
+        config.world_path = NULL;
+        config.recover_path = NULL;
+        config.image_path = NULL;
+        if (replay.header.scene[0] && !(config.scene = Scene_find(replay.header.scene))) {
+            nob_log(NOB_ERROR, "%s starts from the unknown scene `%s`", config.replay_path, replay.header.scene);
+            return 1;
         }
-    }
-    if (row < GRID_SIZE - 1) {
-        size_t down = col + (row+1) * GRID_SIZE;
-        Cell *down_cell = Grid_get_cell(grid, down);
-        if (down_cell->type == CELL_TYPE_NONE && HasNeighbor(grid, col, row+1, CELL_TYPE_WATER)) {
-            down_cell->type = CELL_TYPE_LIFE;
-            down_cell->updated = true;
-            return;
+        config.headless = true;
+        config.ticks = replay.ticks;
+        nob_log(NOB_INFO, "Replaying %zu edits over %d ticks of a %dx%d grid, seed %"PRIu64,
+                replay.edits, config.ticks, config.grid_width, config.grid_height, config.seed);
+    } else if (config.image_path) {
+        if (!load_image(&config.image, config.image_path)) return 1;
+        if (config.image.width < 3 || config.image.width > GRID_PAGED_SIZE_MAX ||
+            config.image.height < 3 || config.image.height > GRID_PAGED_SIZE_MAX) {
+            nob_log(NOB_ERROR, "%s is %dx%d pixels, a grid is between 3 and %d cells a side",
+                    config.image_path, config.image.width, config.image.height, GRID_PAGED_SIZE_MAX);
+            return 1;
         }
-    }
-    if (col > 0) {
-        size_t left = (col-1) + row * GRID_SIZE;
-        if (grid->items[left].type == CELL_TYPE_NONE && HasNeighbor(grid, col-1, row, CELL_TYPE_WATER)) {
-            candidates[count++] = left;
+        config.grid_width = config.image.width;
+        config.grid_height = config.image.height;
+        if (config.record_path) {
+            nob_log(NOB_ERROR, "Recordings start from a scene, they cannot start from an image yet");
+            return 1;
+        }
+    } else if (config.recover_path) {
+        Journal_File journal;
+        if (!Journal_File_open(&journal, config.recover_path)) return 1;
+        config.grid_width = journal.width;
+        config.grid_height = journal.height;
+        config.seed = journal.seed;
+        Journal_File_close(&journal);
+        if (config.record_path) {
+            nob_log(NOB_ERROR, "Recordings start from a scene, they cannot start from a journal yet");
+            return 1;
         }
+    } else if (config.world_path) {
+        World_File world;
+        if (!World_File_open(&world, config.world_path)) return 1;
+        config.grid_width = world.width;
+        config.grid_height = world.height;
+        config.seed = world.seed;
+        World_File_close(&world);
+        if (config.record_path) {
+            nob_log(NOB_ERROR, "Recordings start from a scene, they cannot start from a saved world yet");
+            return 1;
+        }
+    }
+    if ((config.grid_width > GRID_SIZE_MAX || config.grid_height > GRID_SIZE_MAX) && !config.page_path) {
+        nob_log(NOB_ERROR, "A %dx%d grid does not fit in memory, grids over %d cells a side need -page",
+                config.grid_width, config.grid_height, GRID_SIZE_MAX);
+        return 1;
     }
-    if (col < GRID_SIZE - 1) {
-        size_t right = (col+1) + row * GRID_SIZE;
-        if (grid->items[right].type == CELL_TYPE_NONE && HasNeighbor(grid, col+1, row, CELL_TYPE_WATER)) {
-            candidates[count++] = right;
+#ifdef PROFILE
+    Profile_init(&profile);
+#endif
+#ifdef TRACE
+    if (config.trace_path) {
+        Trace_start();
+        Trace_thread("main");
+    }
+#endif
+
+    Frame_Writer writer;
+    // A window must stay responsive and may drop frames, a headless run waits for the disk instead.
+    if (config.export_path && !Frame_Writer_start(&writer, config.export_path, config.export_format,
+                                                  config.grid_width, config.grid_height, !config.headless)) return 1;
+    if (config.headless) {
+        bool ok = run_headless(&config, config.export_path ? &writer : NULL, config.replay_path ? &replay : NULL);
+        Replay_free(&replay);
+        Import_Image_free(&config.image);
+        return ok ? 0 : 1;
+    }
+
+    Replay_Recorder recorder;
+    if (config.record_path) {
+        Replay_Header header = {
+            .seed = config.seed,
+            .width = config.grid_width,
+            .height = config.grid_height,
+        };
+        if (config.scene) snprintf(header.scene, sizeof(header.scene), "%s", config.scene->name);
+        if (!Replay_Recorder_start(&recorder, config.record_path, &header)) return 1;
+    }
+
+    InitWindow(WINDOW_WIDTH, WINDOW_HEIGHT, "SandBox");
+    SetTargetFPS(TARGET_FPS);
+
+    char * legend = temp_sprintf("%dx%d Grid", config.grid_width, config.grid_height);
+    char * controls = "Simulation: P | (-/+) / Elements: Q | W | S | R | E | F | T";
+    char * view_controls = "View: wheel | right drag | arrows | Home / Save: F5";
+    char tick_info[128] = {0}, balance_info[128] = {0};
+#ifdef PROFILE
+    char profile_info[UI_PROFILE_LINES][256] = {0};
+#endif
+#ifdef SIM_COUNTERS
+    char counter_info[UI_COUNTER_LINES][256] = {0};
+#endif
+    double stats_refreshed_at = -UI_STATS_PERIOD;
+
+    Sim sim;
+    Journal journal;
+    Sim_init(&sim, &config, config.export_path ? &writer : NULL, config.record_path ? &recorder : NULL,
+             config.journal_path ? &journal : NULL);
+    Import_Image_free(&config.image);
+    Renderer renderer = {0};
+    Renderer_init(&renderer, config.grid_width, config.grid_height);
+    const Snapshot *snapshot = NULL;
+    View view;
+    View_init(&view, config.grid_width, config.grid_height);
+
+    size_t frame_temp = temp_save();
+    while (!WindowShouldClose()) {
+        temp_rewind(frame_temp);
+        PROFILE_MARK(frame_start);
+
+        PROFILE_SCOPE(&profile, PROFILE_ZONE_INPUT) {
+            if(IsKeyDown(KEY_Q)) curr_place_type = CELL_TYPE_NONE;
+            if(IsKeyDown(KEY_W)) curr_place_type = CELL_TYPE_WATER;
+            if(IsKeyDown(KEY_S)) curr_place_type = CELL_TYPE_SAND;
+            if(IsKeyDown(KEY_R)) curr_place_type = CELL_TYPE_ROCK;
+            if(IsKeyDown(KEY_E)) curr_place_type = CELL_TYPE_SEED;
+            if(IsKeyDown(KEY_F)) curr_place_type = CELL_TYPE_FIRE;
+            if(IsKeyDown(KEY_T)) curr_place_type = CELL_TYPE_OIL;
+            if(IsKeyPressed(KEY_P)) Sim_toggle_pause(&sim);
+            // Snapshots only hold the view, the simulation saves the grid between two ticks.
+            if(IsKeyPressed(KEY_F5)) Sim_request_save(&sim);
+            if(IsKeyPressed(KEY_EQUAL)) Sim_change_speed(&sim, -1);
+            if(IsKeyPressed(KEY_MINUS)) Sim_change_speed(&sim, 1);
+
+            if(IsKeyPressed(KEY_HOME)) View_reset(&view);
+
+            float wheel = GetMouseWheelMove();
+            if(wheel != 0) View_zoom_at(&view, powf(VIEW_ZOOM_STEP, wheel), GetMousePosition());
+            if(IsMouseButtonDown(MOUSE_RIGHT_BUTTON)) {
+                Vector2 delta = GetMouseDelta();
+                View_pan(&view, -delta.x, -delta.y);
+            }
+            float pan = VIEW_PAN_SPEED * GetFrameTime();
+            if(IsKeyDown(KEY_LEFT)) View_pan(&view, -pan, 0);
+            if(IsKeyDown(KEY_RIGHT)) View_pan(&view, pan, 0);
+            if(IsKeyDown(KEY_UP)) View_pan(&view, 0, -pan);
+            if(IsKeyDown(KEY_DOWN)) View_pan(&view, 0, pan);
+
+            if(IsMouseButtonDown(MOUSE_LEFT_BUTTON)) UpdateMouseRect(&sim, &view);
+#ifdef PROFILE
+            if(IsKeyPressed(KEY_F2)) {
+                if (profile.csv) Profile_csv_stop(&profile);
+                else Profile_csv_start(&profile, PROFILE_CSV_PATH);
+            }
+#endif
+        }
+
+        // Always draw the newest complete snapshot, whatever the simulation is doing now.
+        bool grid_changed = false;
+#ifdef PERF
+        Perf_Counts render_start = Perf_read();
+#endif
+        PROFILE_SCOPE(&profile, PROFILE_ZONE_RENDER) {
+            Sim_set_view(&sim, Renderer_view(&renderer, &view));
+            const Snapshot *newest = Snapshot_Buffer_acquire(&sim.snapshots);
+            if (newest) snapshot = newest;
+            grid_changed = Renderer_prepare(&renderer, snapshot, &view);
         }
+#ifdef PERF
+        Perf_Counts render_end = Perf_read();
+        Perf_Counts_add_since(&perf.render, &render_start, &render_end);
+        perf.texels += VIEW_TEXELS * VIEW_TEXELS;
+#endif
+
+        // The UI bar only changes when its statistics are refreshed to something new.
+        bool ui_changed = false;
+        if (GetTime() - stats_refreshed_at >= UI_STATS_PERIOD) {
+            stats_refreshed_at = GetTime();
+            char info[ARRAY_LEN(tick_info)];
+            snprintf(info, sizeof(info), "seed %"PRIu64", tick %.2f ms", snapshot->seed, snapshot->stats.time_ms);
+            if (strcmp(info, tick_info) != 0) {
+                memcpy(tick_info, info, sizeof(info));
+                ui_changed = true;
+            }
+            snprintf(info, sizeof(info), "%zu chunks, %zu stolen, %.0f%% balanced",
+                     snapshot->stats.chunks, snapshot->stats.steals, snapshot->stats.balance * 100);
+            if (strcmp(info, balance_info) != 0) {
+                memcpy(balance_info, info, sizeof(info));
+                ui_changed = true;
+            }
+#ifdef PROFILE
+            // Always changes, the averages move with every sample.
+            format_profile(profile_info[0], sizeof(profile_info[0]), PROFILE_ZONE_FRAME, PROFILE_ZONE_UPDATE, "");
+            format_profile(profile_info[1], sizeof(profile_info[1]), PROFILE_ZONE_UPDATE, PROFILE_ZONE_COUNT,
+                           profile.csv ? "(avg/p99 ms, F2 stops the CSV)" : "(avg/p99 ms, F2 dumps a CSV)");
+            ui_changed = true;
+#endif
+#ifdef SIM_COUNTERS
+            char counters[UI_COUNTER_LINES][256];
+            format_counters(counters, snapshot);
+            if (memcmp(counters, counter_info, sizeof(counters)) != 0) {
+                memcpy(counter_info, counters, sizeof(counters));
+                ui_changed = true;
+            }
+#endif
+        }
+
+        if (!grid_changed && !ui_changed) {
+            // Nothing new to show: keep the last frame on screen and only poll input.
+            PollInputEvents();
+            WaitTime(1.0 / TARGET_FPS);
+            continue;
+        }
+
+        PROFILE_SCOPE(&profile, PROFILE_ZONE_DRAW) {
+            BeginDrawing();
+
+            ClearBackground(BACKGROUND_COLOR);
+
+            DrawText(legend, 10, 10, 20, WHITE);
+            DrawText(controls, 140, 4, 10, WHITE);
+            DrawText(view_controls, 140, 16, 10, WHITE);
+            DrawText(tick_info, WINDOW_WIDTH - MeasureText(tick_info, 10) - 10, 4, 10, WHITE);
+            DrawText(balance_info, WINDOW_WIDTH - MeasureText(balance_info, 10) - 10, 16, 10, WHITE);
+#ifdef PROFILE
+            for (int i = 0; i < UI_PROFILE_LINES; ++i) DrawText(profile_info[i], 10, 30 + i * UI_LINE_HEIGHT, 10, WHITE);
+#endif
+#ifdef SIM_COUNTERS
+            for (int i = 0; i < UI_COUNTER_LINES; ++i) {
+                DrawText(counter_info[i], 10, 30 + (UI_PROFILE_LINES + i) * UI_LINE_HEIGHT, 10, WHITE);
+            }
+#endif
+
+            Renderer_draw(&renderer);
+
+            DrawRectangleLinesEx(renderer.dest, 1, BLACK);
+
+            EndDrawing();
+        }
+        PROFILE_SINCE(&profile, PROFILE_ZONE_FRAME, frame_start);
+#ifdef PROFILE
+        Profile_csv_frame(&profile);
+#endif
     }
 
-    if (count == 0) return;
+    Renderer_free(&renderer);
+    Sim_free(&sim);
+#ifdef PERF
+    perf_log();
+    Perf_thread_stop();
+#endif
+#ifdef PROFILE
+    Profile_free(&profile);
+#endif
+    bool ok = !config.export_path || Frame_Writer_finish(&writer);
+    if (config.record_path) ok = Replay_Recorder_finish(&recorder, sim.ticks) && ok;
+    if (config.journal_path) ok = !journal.failed && ok;
+#ifdef TRACE
+    if (config.trace_path) ok = Trace_write(config.trace_path) && ok;
+#endif
+
+    CloseWindow();
+
+    return ok ? 0 : 1;
+}
+
+void UpdateMouseRect(Sim *sim, const View *view) {
+    Vector2 mouse_pos = GetMousePosition();
+    mouse_rect.x = mouse_pos.x;
+    mouse_rect.y = mouse_pos.y;
 
-    int choice = GetRandomValue(0, count-1);
-    size_t chosen = candidates[choice];
-    Cell *chosen_cell = Grid_get_cell(grid, chosen);
+    Vector2 cell = View_to_cell(view, mouse_pos);
+    int col = floorf(cell.x);
+    int row = floorf(cell.y);
 
-    chosen_cell->type = CELL_TYPE_LIFE;
-    chosen_cell->updated = true;
+    if(mouse_rect.y < UI_OFFSET || col < 0 || col >= sim->grid.width || row < 0 || row >= sim->grid.height) return;
+    if(CheckCollisionRecs(View_cell_rect(view, col, row), mouse_rect)) {
+        Sim_push_edit(sim, (Edit) { .col = col, .row = row, .type = curr_place_type });
+    }
 }
@@ -0,0 +1,137 @@
+#ifndef IMPORT_H_
+#define IMPORT_H_
+// Builds a world from an image: every pixel becomes the cell type whose colour in
+// Cell_Type_color_table is nearest, so a frame exported as PPM imports back as the same
+// world. Colours go through a lookup table of 6 bits per channel, built once per import,
+// which turns the conversion into one load per pixel, and rows are written into the grid
+// a chunk row at a time. Binary PPM is read here, other formats are up to the caller.
+// Define IMPORT_IMPLEMENTATION in exactly one translation unit before including this file.
+#include "sim.h"
+
+#define IMPORT_LUT_BITS 6
+
+typedef struct {
+    uint8_t *rgb; // width * height pixels of three bytes, row-major, from malloc
+    int width, height;
+} Import_Image;
+
+// Reads a binary PPM (P6) of 8 bits per channel.
+bool Import_load_ppm(Import_Image *image, const char *path);
+// Fills an empty grid of the same size as the image.
+void Import_image(Grid *grid, const Import_Image *image);
+void Import_Image_free(Import_Image *image);
+
+#ifdef IMPORT_IMPLEMENTATION
+
+#include <ctype.h>
+
+// Skips whitespace and `#` comments, then reads a decimal number of the PPM header.
+static bool Import_ppm_number(const uint8_t *data, size_t size, size_t *cursor, int *value) {
+    while (*cursor < size && (isspace(data[*cursor]) || data[*cursor] == '#')) {
+        if (data[*cursor] == '#') {
+            while (*cursor < size && data[*cursor] != '\n') (*cursor)++;
+        } else {
+            (*cursor)++;
+        }
+    }
+    if (*cursor >= size || !isdigit(data[*cursor])) return false;
+    long number = 0;
+    while (*cursor < size && isdigit(data[*cursor]) && number <= INT_MAX) number = number * 10 + (data[(*cursor)++] - '0');
+    *value = number > INT_MAX ? INT_MAX : number;
+    return true;
+}
+
+bool Import_load_ppm(Import_Image *image, const char *path) {
+    *image = (Import_Image) {0};
+    Nob_String_Builder sb = {0};
+    if (!nob_read_entire_file(path, &sb)) return false;
+
+    const uint8_t *data = (const uint8_t *)sb.items;
+    size_t cursor = 2;
+    int width, height, max;
+    if (sb.count < 2 || memcmp(data, "P6", 2) != 0 || !Import_ppm_number(data, sb.count, &cursor, &width) ||
+        !Import_ppm_number(data, sb.count, &cursor, &height) || !Import_ppm_number(data, sb.count, &cursor, &max) ||
+        cursor >= sb.count || !isspace(data[cursor])) {
+        nob_log(NOB_ERROR, "%s is not a binary PPM", path);
+        nob_sb_free(sb);
+        return false;
+    }
+    cursor++;
+    size_t pixels = (size_t)width * height * 3;
+    if (max != 255 || width == 0 || height == 0 || pixels > sb.count - cursor) {
+        nob_log(NOB_ERROR, "%s is not an 8-bit PPM of %dx%d pixels", path, width, height);
+        nob_sb_free(sb);
+        return false;
+    }
+    // The pixels move to the front of the buffer, which the image keeps.
+    memmove(sb.items, sb.items + cursor, pixels);
+    *image = (Import_Image) { .rgb = (uint8_t *)sb.items, .width = width, .height = height };
+    return true;
+}
+
+void Import_Image_free(Import_Image *image) {
+    free(image->rgb);
+    *image = (Import_Image) {0};
+}
+
+static inline size_t Import_lut_index(uint8_t r, uint8_t g, uint8_t b) {
+    const int shift = 8 - IMPORT_LUT_BITS;
+    return (size_t)(r >> shift) << (2 * IMPORT_LUT_BITS) | (size_t)(g >> shift) << IMPORT_LUT_BITS | (b >> shift);
+}
+
+// Fills `lut` with the nearest type of the colour at the middle of every cell of the table.
+static void Import_build_lut(uint8_t *lut) {
+    const int shift = 8 - IMPORT_LUT_BITS, side = 1 << IMPORT_LUT_BITS;
+    // Bedrock shares the colour of rock and only makes the halo.
+    const Cell_Type last = CELL_TYPE_BEDROCK - 1;
+    for (int r = 0; r < side; ++r) {
+        for (int g = 0; g < side; ++g) {
+            for (int b = 0; b < side; ++b) {
+                int cr = (r << shift) + (1 << shift) / 2, cg = (g << shift) + (1 << shift) / 2, cb = (b << shift) + (1 << shift) / 2;
+                int best = INT_MAX;
+                uint8_t nearest = CELL_TYPE_NONE;
+                for (Cell_Type type = 0; type <= last; ++type) {
+                    Rgb color = Cell_Type_color_table[type];
+                    int dr = cr - color.r, dg = cg - color.g, db = cb - color.b;
+                    int distance = dr * dr + dg * dg + db * db;
+                    if (distance < best) {
+                        best = distance;
+                        nearest = type;
+                    }
+                }
+                lut[(size_t)r << (2 * IMPORT_LUT_BITS) | (size_t)g << IMPORT_LUT_BITS | b] = nearest;
+            }
+        }
+    }
+    // The exact colours always get their own type, whatever else shares their cell of the table.
+    for (Cell_Type type = 0; type <= last; ++type) {
+        Rgb color = Cell_Type_color_table[type];
+        lut[Import_lut_index(color.r, color.g, color.b)] = type;
+    }
+}
+
+void Import_image(Grid *grid, const Import_Image *image) {
+    NOB_ASSERT(grid->width == image->width && grid->height == image->height && "Import_image");
+    uint8_t *lut = malloc((size_t)1 << (3 * IMPORT_LUT_BITS));
+    uint8_t *row_types = malloc(image->width);
+    unwrap_null(lut);
+    unwrap_null(row_types);
+    Import_build_lut(lut);
+
+    for (int row = 0; row < image->height; ++row) {
+        const uint8_t *rgb = image->rgb + (size_t)row * image->width * 3;
+        for (int col = 0; col < image->width; ++col, rgb += 3) {
+            row_types[col] = lut[Import_lut_index(rgb[0], rgb[1], rgb[2])];
+        }
+        for (int col = 0; col < image->width; col += CHUNK_SIZE) {
+            int count = image->width - col < CHUNK_SIZE ? image->width - col : CHUNK_SIZE;
+            Grid_fill_empty_row(grid, col, row, row_types + col, count);
+        }
+    }
+    free(row_types);
+    free(lut);
+}
+
+#endif // IMPORT_IMPLEMENTATION
+
+#endif // IMPORT_H_
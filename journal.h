@@ -0,0 +1,566 @@
+#ifndef JOURNAL_H_
+#define JOURNAL_H_
+// Continuous autosave: an append-only file that starts with a checkpoint of every chunk
+// and then gets one delta record per window of ticks, holding only the chunks whose cells
+// changed. A chunk changed when it was woken since the previous record, see
+// Grid::changed_at, and its cells hash differently from what was last written. Chunks
+// are encoded as in world.h, so a mostly settled world with one waterfall writes a few
+// chunks of runs per window instead of the whole grid.
+//
+// The simulation only hashes the chunks that were woken and copies the cells of those
+// that changed. Encoding, writing and syncing every record happen on a writer thread, and
+// so does compaction: once the deltas outweigh the checkpoint, the writer gathers the
+// last record of every chunk from the journal itself into a fresh checkpoint, writes it
+// to a new file and renames it over the old one, so a crash at any point leaves either
+// journal whole. Recovery decodes the checkpoint and applies the deltas in order, stopping
+// at the first record that did not make it to disk entirely. Define JOURNAL_IMPLEMENTATION
+// in exactly one translation unit, after WORLD_IMPLEMENTATION, before including this file.
+//
+// File layout, integers little-endian:
+//
+//     "SBJN", u32 version, u64 seed, u32 width, u32 height, u32 chunk size, u32 0
+//     records: u8 kind, 3 zero bytes, u32 chunks, u64 tick, u64 payload size, u64 hash, payload
+//     payload, for each chunk: varint chunk index, u8 encoding, u8 type, varint size, chunk payload
+//
+// The first record is the only checkpoint.
+#include "world.h"
+
+#define JOURNAL_MAGIC "SBJN"
+#define JOURNAL_VERSION 1
+#define JOURNAL_HEADER_SIZE 32
+#define JOURNAL_RECORD_HEADER_SIZE 32
+// Longest entry of a chunk in a record: two varints, encoding, type and a packed payload.
+#define JOURNAL_ENTRY_SIZE_MAX (2 * 10 + 2 + CHUNK_SIZE * CHUNK_SIZE / 2)
+
+// Deltas waiting to be written. When the writer falls this far behind, the simulation
+// waits for it, nothing is ever dropped.
+#define JOURNAL_QUEUE_SIZE 4
+
+typedef enum {
+    JOURNAL_CHECKPOINT, // every chunk
+    JOURNAL_DELTA,      // the chunks that changed since the previous record
+} Journal_Record_Kind;
+
+// The chunks that changed in one window of ticks.
+typedef struct {
+    uint64_t tick;
+    struct {
+        int *items;
+        size_t count;
+        size_t capacity;
+    } chunks;                 // indices, in order
+    Nob_String_Builder cells; // of every chunk in turn, rows packed
+} Journal_Batch;
+
+// Writes the journal of one grid. Journal_sync is called from the thread that ticks it,
+// the file only ever from the writer thread.
+typedef struct {
+    const char *path;
+    char *tmp_path;          // where a compacted journal is written before it replaces `path`
+    uint64_t seed;
+    int width, height, chunks_x, chunks_y;
+
+    // Owned by the ticking thread.
+    uint64_t version;        // Grid::version of the previous record, older changes are queued
+    uint64_t *hashes;        // of the cells of every chunk as last queued
+
+    // Owned by the writer thread once it runs.
+    FILE *file;
+    uint64_t *offsets;       // in the file, of the last entry of every chunk
+    size_t size;             // of the file
+    size_t checkpoint_size;  // bytes of the checkpoint, the header included
+    size_t delta_size;       // bytes of the deltas since
+    Nob_String_Builder record, chunk; // record being built, payload of one chunk
+    size_t checkpoints, deltas, chunks, bytes; // written by this run
+
+    Journal_Batch batches[JOURNAL_QUEUE_SIZE];
+    size_t head, tail;       // batches[head % JOURNAL_QUEUE_SIZE] is filled next, batches[tail % ...] written next
+    bool failed;             // nothing is written anymore after a failure
+    bool started;            // the writer thread runs
+    pthread_mutex_t mutex;
+    pthread_cond_t ready;    // a batch was queued, or the journal is done
+    pthread_cond_t freed;    // a batch was written
+    bool done;
+    pthread_t thread;
+} Journal;
+
+// Starts a journal at `path` with a checkpoint of `grid`, replacing any file there. The
+// checkpoint is encoded now and written by the writer thread.
+bool Journal_start(Journal *journal, const char *path, Grid *grid, uint64_t tick);
+// Queues the chunks that changed since the previous record, called between ticks. Only
+// waits when the writer is JOURNAL_QUEUE_SIZE records behind. Returns false once anything
+// failed to write.
+bool Journal_sync(Journal *journal, Grid *grid, uint64_t tick);
+// Syncs one last time, waits for every record to be on disk and closes the file. `failed`
+// stays readable afterwards.
+bool Journal_finish(Journal *journal, Grid *grid, uint64_t tick);
+
+typedef struct {
+    Nob_String_Builder data;
+    const char *path;
+    uint64_t seed;
+    int width, height;
+    size_t records;   // whole records, from the checkpoint on
+    size_t end;       // offset past the last whole record
+    uint64_t tick;    // of the last whole record
+} Journal_File;
+
+// Reads a journal and checks its header and records. A torn record at the end, from a
+// crash halfway through a write, and anything after it are left out of the recovery.
+bool Journal_File_open(Journal_File *journal, const char *path);
+// Decodes the checkpoint and every delta into an empty grid of the same size.
+bool Journal_File_recover(const Journal_File *journal, Grid *grid);
+void Journal_File_close(Journal_File *journal);
+
+#ifdef JOURNAL_IMPLEMENTATION
+
+#include <fcntl.h>
+#include <unistd.h>
+
+// Hashes a record or the cells of a chunk, eight bytes at a time in host order, which is
+// little-endian on every target the game builds for.
+static uint64_t Journal_hash(uint64_t hash, const uint8_t *data, size_t size) {
+    size_t i = 0;
+    for (; i + 8 <= size; i += 8) {
+        uint64_t word;
+        memcpy(&word, data + i, 8);
+        hash = (hash ^ word) * 0x9E3779B97F4A7C15ull;
+        hash ^= hash >> 32;
+    }
+    for (; i < size; ++i) hash = (hash ^ data[i]) * 0x100000001B3ull;
+    return splitmix64(hash);
+}
+
+static uint64_t Journal_hash_chunk(const Grid *grid, int chunk) {
+    World_Chunk_Rect rect = World_chunk_rect(grid->width, grid->height, grid->chunks_x, chunk);
+    uint64_t hash = 0;
+    for (int row = rect.y0; row < rect.y1; ++row) {
+        hash = Journal_hash(hash, &grid->types[Grid_index(grid, rect.x0, row)], rect.x1 - rect.x0);
+    }
+    return hash;
+}
+
+static uint64_t Journal_record_hash(const uint8_t *header, const uint8_t *payload, size_t size) {
+    return Journal_hash(Journal_hash(0, header, 24), payload, size);
+}
+
+// Reads a varint at `*cursor` of a payload of `size` bytes.
+static bool Journal_get_varint(const uint8_t *data, size_t size, size_t *cursor, uint64_t *value) {
+    *value = 0;
+    for (int shift = 0; shift < 64 && *cursor < size; shift += 7) {
+        uint8_t byte = data[(*cursor)++];
+        *value |= (uint64_t)(byte & 0x7F) << shift;
+        if (!(byte & 0x80)) return true;
+    }
+    return false;
+}
+
+static void Journal_begin_record(Journal *journal) {
+    journal->record.count = 0;
+    nob_da_reserve(&journal->record, JOURNAL_RECORD_HEADER_SIZE);
+    memset(journal->record.items, 0, JOURNAL_RECORD_HEADER_SIZE);
+    journal->record.count = JOURNAL_RECORD_HEADER_SIZE;
+}
+
+// Appends the width x height cells of a chunk to the record, which goes to the file at
+// `offset`.
+static void Journal_put_chunk(Journal *journal, int chunk, const uint8_t *types, size_t stride, int width, int height, size_t offset) {
+    journal->offsets[chunk] = offset + journal->record.count;
+    journal->chunk.count = 0;
+    World_Chunk info = World_encode_cells(&journal->chunk, types, stride, width, height);
+    Nob_String_Builder *sb = &journal->record;
+    World_put_varint(sb, chunk);
+    nob_da_append(sb, (char)info.encoding);
+    nob_da_append(sb, (char)info.type);
+    World_put_varint(sb, info.size);
+    // Uniform chunks have no payload, and no buffer either.
+    if (journal->chunk.count > 0) nob_sb_append_buf(sb, journal->chunk.items, journal->chunk.count);
+    journal->chunks++;
+}
+
+static void Journal_end_record(Journal *journal, Journal_Record_Kind kind, uint32_t chunks, uint64_t tick) {
+    uint8_t *header = (uint8_t *)journal->record.items;
+    size_t size = journal->record.count - JOURNAL_RECORD_HEADER_SIZE;
+    header[0] = kind;
+    World_store_le(header + 4, chunks, 4);
+    World_store_le(header + 8, tick, 8);
+    World_store_le(header + 16, size, 8);
+    World_store_le(header + 24, Journal_record_hash(header, header + JOURNAL_RECORD_HEADER_SIZE, size), 8);
+}
+
+// Writes `size` bytes and makes sure they reached the disk.
+static bool Journal_write(Journal *journal, FILE *file, const char *path, const void *data, size_t size) {
+    if (fwrite(data, 1, size, file) != size || fflush(file) != 0 || fdatasync(fileno(file)) != 0) {
+        nob_log(NOB_ERROR, "Could not write %s: %s, the journal stops here", path, strerror(errno));
+        return false;
+    }
+    journal->bytes += size;
+    return true;
+}
+
+// Every change up to now is in the journal once the record is written, later ones are
+// stamped with a newer version.
+static void Journal_mark_written(Journal *journal, Grid *grid) {
+    journal->version = grid->version;
+    grid->version++;
+}
+
+// Syncs the directory of `path`, so that a rename in it survives a crash.
+static bool Journal_sync_directory(const char *path) {
+    const char *slash = strrchr(path, '/');
+    char directory[4096];
+    if (!slash) snprintf(directory, sizeof(directory), ".");
+    else snprintf(directory, sizeof(directory), "%.*s", slash == path ? 1 : (int)(slash - path), path);
+    int fd = open(directory, O_RDONLY | O_DIRECTORY);
+    if (fd < 0) return false;
+    bool ok = fsync(fd) == 0;
+    close(fd);
+    return ok;
+}
+
+// Opens the file a checkpoint is written to before it replaces the journal. It is read
+// back from when the next checkpoint gathers the chunks.
+static FILE *Journal_open_checkpoint(Journal *journal) {
+    FILE *file = fopen(journal->tmp_path, "wb+");
+    if (!file) nob_log(NOB_ERROR, "Could not open %s: %s, the journal stops here", journal->tmp_path, strerror(errno));
+    return file;
+}
+
+// Writes the checkpoint in the record to `file` and puts it in place of the journal, which
+// drops every delta so far. The checkpoint of Journal_start goes to the file it opened.
+static bool Journal_install_checkpoint(Journal *journal, FILE *file) {
+    uint8_t header[JOURNAL_HEADER_SIZE] = JOURNAL_MAGIC;
+    World_store_le(header + 4, JOURNAL_VERSION, 4);
+    World_store_le(header + 8, journal->seed, 8);
+    World_store_le(header + 16, journal->width, 4);
+    World_store_le(header + 20, journal->height, 4);
+    World_store_le(header + 24, CHUNK_SIZE, 4);
+
+    if (!Journal_write(journal, file, journal->tmp_path, header, sizeof(header)) ||
+        !Journal_write(journal, file, journal->tmp_path, journal->record.items, journal->record.count)) {
+        if (file != journal->file) fclose(file);
+        return false;
+    }
+    if (rename(journal->tmp_path, journal->path) != 0 || !Journal_sync_directory(journal->path)) {
+        nob_log(NOB_ERROR, "Could not replace %s: %s, the journal stops here", journal->path, strerror(errno));
+        if (file != journal->file) fclose(file);
+        return false;
+    }
+    // The file is now the journal itself, deltas go on after the checkpoint.
+    if (journal->file && journal->file != file) fclose(journal->file);
+    journal->file = file;
+    journal->size = journal->checkpoint_size = sizeof(header) + journal->record.count;
+    journal->delta_size = 0;
+    journal->checkpoints++;
+    return true;
+}
+
+// Gathers the last entry of every chunk from the journal into a new checkpoint, without
+// touching the grid.
+static bool Journal_compact(Journal *journal, uint64_t tick) {
+    FILE *file = Journal_open_checkpoint(journal);
+    if (!file) return false;
+    int fd = fileno(journal->file);
+    size_t chunks = (size_t)journal->chunks_x * journal->chunks_y;
+    uint8_t entry[JOURNAL_ENTRY_SIZE_MAX];
+    Journal_begin_record(journal);
+    for (size_t chunk = 0; chunk < chunks; ++chunk) {
+        ssize_t got = pread(fd, entry, sizeof(entry), journal->offsets[chunk]);
+        size_t size = got > 0 ? (size_t)got : 0, cursor = 0;
+        uint64_t index, length;
+        bool ok = Journal_get_varint(entry, size, &cursor, &index) && index == chunk && cursor + 2 <= size;
+        cursor += 2;
+        ok = ok && Journal_get_varint(entry, size, &cursor, &length) && length <= size - cursor;
+        if (!ok) {
+            nob_log(NOB_ERROR, "Could not read chunk %zu back from %s, the journal stops here", chunk, journal->path);
+            fclose(file);
+            return false;
+        }
+        journal->offsets[chunk] = JOURNAL_HEADER_SIZE + journal->record.count;
+        nob_sb_append_buf(&journal->record, entry, cursor + length);
+        journal->chunks++;
+    }
+    Journal_end_record(journal, JOURNAL_CHECKPOINT, chunks, tick);
+    return Journal_install_checkpoint(journal, file);
+}
+
+// Encodes and appends one delta, then compacts the journal once the deltas are larger
+// than the checkpoint.
+static bool Journal_write_batch(Journal *journal, const Journal_Batch *batch) {
+    const uint8_t *cells = (const uint8_t *)batch->cells.items;
+    Journal_begin_record(journal);
+    for (size_t i = 0; i < batch->chunks.count; ++i) {
+        int chunk = batch->chunks.items[i];
+        World_Chunk_Rect rect = World_chunk_rect(journal->width, journal->height, journal->chunks_x, chunk);
+        int width = rect.x1 - rect.x0, height = rect.y1 - rect.y0;
+        Journal_put_chunk(journal, chunk, cells, width, width, height, journal->size);
+        cells += (size_t)width * height;
+    }
+    Journal_end_record(journal, JOURNAL_DELTA, batch->chunks.count, batch->tick);
+    if (!Journal_write(journal, journal->file, journal->path, journal->record.items, journal->record.count)) return false;
+    journal->size += journal->record.count;
+    journal->delta_size += journal->record.count;
+    journal->deltas++;
+    if (journal->delta_size > journal->checkpoint_size) {
+        bool ok;
+        TRACE_SCOPE("compact journal", batch->tick) {
+            ok = Journal_compact(journal, batch->tick);
+        }
+        return ok;
+    }
+    return true;
+}
+
+static void *Journal_main(void *arg) {
+    Journal *journal = arg;
+#ifdef TRACE
+    Trace_thread("journal writer");
+#endif
+    bool ok;
+    TRACE_SCOPE("write journal", TRACE_NO_ID) {
+        ok = Journal_install_checkpoint(journal, journal->file);
+    }
+
+    pthread_mutex_lock(&journal->mutex);
+    journal->failed |= !ok;
+    for (;;) {
+        while (!journal->done && journal->head == journal->tail) pthread_cond_wait(&journal->ready, &journal->mutex);
+        if (journal->head == journal->tail) break;
+        Journal_Batch *batch = &journal->batches[journal->tail % JOURNAL_QUEUE_SIZE];
+        bool failed = journal->failed;
+        pthread_mutex_unlock(&journal->mutex);
+
+        // After a failure the queue is still drained, so the simulation never waits on it.
+        ok = true;
+        if (!failed) {
+            TRACE_SCOPE("write journal", batch->tick) {
+                ok = Journal_write_batch(journal, batch);
+            }
+        }
+
+        pthread_mutex_lock(&journal->mutex);
+        journal->failed |= !ok;
+        journal->tail++;
+        pthread_cond_signal(&journal->freed);
+    }
+    pthread_mutex_unlock(&journal->mutex);
+    return NULL;
+}
+
+bool Journal_start(Journal *journal, const char *path, Grid *grid, uint64_t tick) {
+    *journal = (Journal) {
+        .path = path,
+        .seed = grid->seed,
+        .width = grid->width,
+        .height = grid->height,
+        .chunks_x = grid->chunks_x,
+        .chunks_y = grid->chunks_y,
+    };
+    size_t chunks = (size_t)grid->chunks_x * grid->chunks_y;
+    size_t length = strlen(path) + sizeof(".tmp");
+    journal->tmp_path = malloc(length);
+    journal->hashes = malloc(chunks * sizeof(*journal->hashes));
+    journal->offsets = malloc(chunks * sizeof(*journal->offsets));
+    unwrap_null(journal->tmp_path);
+    unwrap_null(journal->hashes);
+    unwrap_null(journal->offsets);
+    snprintf(journal->tmp_path, length, "%s.tmp", path);
+    pthread_mutex_init(&journal->mutex, NULL);
+    pthread_cond_init(&journal->ready, NULL);
+    pthread_cond_init(&journal->freed, NULL);
+    journal->file = Journal_open_checkpoint(journal);
+    if (!journal->file) {
+        journal->failed = true;
+        return false;
+    }
+
+    // Every chunk goes in, so the grid loads the ones it has yet to.
+    Grid_load_all(grid);
+    const uint8_t *types = &grid->types[Grid_index(grid, 0, 0)];
+    Journal_begin_record(journal);
+    for (size_t chunk = 0; chunk < chunks; ++chunk) {
+        World_Chunk_Rect rect = World_chunk_rect(grid->width, grid->height, grid->chunks_x, chunk);
+        Journal_put_chunk(journal, chunk, &types[rect.y0 * grid->stride + rect.x0], grid->stride,
+                          rect.x1 - rect.x0, rect.y1 - rect.y0, JOURNAL_HEADER_SIZE);
+        journal->hashes[chunk] = Journal_hash_chunk(grid, chunk);
+    }
+    Journal_end_record(journal, JOURNAL_CHECKPOINT, chunks, tick);
+    Journal_mark_written(journal, grid);
+    size_t size = JOURNAL_HEADER_SIZE + journal->record.count;
+
+    if (pthread_create(&journal->thread, NULL, Journal_main, journal) != 0) {
+        nob_log(NOB_ERROR, "Could not start the journal writer thread");
+        journal->failed = true;
+        return false;
+    }
+    journal->started = true;
+    nob_log(NOB_INFO, "Journaling the world to %s, the checkpoint is %zu bytes", path, size);
+    return true;
+}
+
+bool Journal_sync(Journal *journal, Grid *grid, uint64_t tick) {
+    if (!journal->started) return false;
+    pthread_mutex_lock(&journal->mutex);
+    while (!journal->failed && journal->head - journal->tail == JOURNAL_QUEUE_SIZE) {
+        pthread_cond_wait(&journal->freed, &journal->mutex);
+    }
+    bool failed = journal->failed;
+    Journal_Batch *batch = &journal->batches[journal->head % JOURNAL_QUEUE_SIZE];
+    pthread_mutex_unlock(&journal->mutex);
+    if (failed) return false;
+
+    // The batch at head is never touched by the writer thread until head moves past it.
+    batch->tick = tick;
+    batch->chunks.count = 0;
+    batch->cells.count = 0;
+    for (int chunk = 0; chunk < grid->chunks_x * grid->chunks_y; ++chunk) {
+        if (atomic_load_explicit(&grid->changed_at[chunk], memory_order_relaxed) <= journal->version) continue;
+        // Chunks are also woken by changes next to them, only those whose cells differ go in.
+        uint64_t hash = Journal_hash_chunk(grid, chunk);
+        if (hash == journal->hashes[chunk]) continue;
+        journal->hashes[chunk] = hash;
+
+        World_Chunk_Rect rect = World_chunk_rect(grid->width, grid->height, grid->chunks_x, chunk);
+        int width = rect.x1 - rect.x0;
+        for (int row = rect.y0; row < rect.y1; ++row) {
+            nob_sb_append_buf(&batch->cells, &grid->types[Grid_index(grid, rect.x0, row)], width);
+        }
+        nob_da_append(&batch->chunks, chunk);
+    }
+    Journal_mark_written(journal, grid);
+    if (batch->chunks.count == 0) return true;
+
+    pthread_mutex_lock(&journal->mutex);
+    journal->head++;
+    pthread_cond_signal(&journal->ready);
+    pthread_mutex_unlock(&journal->mutex);
+    return true;
+}
+
+bool Journal_finish(Journal *journal, Grid *grid, uint64_t tick) {
+    if (journal->started) {
+        Journal_sync(journal, grid, tick);
+        pthread_mutex_lock(&journal->mutex);
+        journal->done = true;
+        pthread_cond_signal(&journal->ready);
+        pthread_mutex_unlock(&journal->mutex);
+        pthread_join(journal->thread, NULL);
+    }
+
+    bool ok = journal->started && !journal->failed;
+    if (journal->file) ok = fclose(journal->file) == 0 && ok;
+    if (ok) {
+        nob_log(NOB_INFO, "Journaled %zu checkpoints and %zu deltas, %zu chunks in %zu bytes, to %s",
+                journal->checkpoints, journal->deltas, journal->chunks, journal->bytes, journal->path);
+    }
+    pthread_mutex_destroy(&journal->mutex);
+    pthread_cond_destroy(&journal->ready);
+    pthread_cond_destroy(&journal->freed);
+    for (size_t i = 0; i < JOURNAL_QUEUE_SIZE; ++i) {
+        nob_da_free(journal->batches[i].chunks);
+        nob_sb_free(journal->batches[i].cells);
+    }
+    free(journal->tmp_path);
+    free(journal->hashes);
+    free(journal->offsets);
+    nob_sb_free(journal->record);
+    nob_sb_free(journal->chunk);
+    *journal = (Journal) { .path = journal->path, .failed = !ok };
+    return ok;
+}
+
+bool Journal_File_open(Journal_File *journal, const char *path) {
+    *journal = (Journal_File) { .path = path };
+    if (!nob_read_entire_file(path, &journal->data)) return false;
+
+    const uint8_t *data = (const uint8_t *)journal->data.items;
+    size_t size = journal->data.count;
+    const char *problem = NULL;
+    if (size < JOURNAL_HEADER_SIZE || memcmp(data, JOURNAL_MAGIC, 4) != 0) {
+        problem = "is not a journal";
+    } else if (World_get_le(data + 4, 4) != JOURNAL_VERSION) {
+        problem = "has an unsupported version";
+    } else {
+        journal->seed = World_get_le(data + 8, 8);
+        journal->width = World_get_le(data + 16, 4);
+        journal->height = World_get_le(data + 20, 4);
+        if (journal->width < 3 || journal->width > GRID_PAGED_SIZE_MAX || journal->height < 3 || journal->height > GRID_PAGED_SIZE_MAX) {
+            problem = "has an unsupported size";
+        } else if (World_get_le(data + 24, 4) != CHUNK_SIZE) {
+            problem = "has chunks of another size";
+        }
+    }
+
+    size_t offset = JOURNAL_HEADER_SIZE;
+    while (!problem && offset + JOURNAL_RECORD_HEADER_SIZE <= size) {
+        const uint8_t *header = data + offset;
+        uint64_t payload = World_get_le(header + 16, 8);
+        if (payload > size - offset - JOURNAL_RECORD_HEADER_SIZE ||
+            World_get_le(header + 24, 8) != Journal_record_hash(header, header + JOURNAL_RECORD_HEADER_SIZE, payload)) {
+            break;
+        }
+        if (header[0] != (journal->records == 0 ? JOURNAL_CHECKPOINT : JOURNAL_DELTA)) problem = "has a broken record";
+        journal->tick = World_get_le(header + 8, 8);
+        journal->records++;
+        offset += JOURNAL_RECORD_HEADER_SIZE + payload;
+    }
+    if (!problem && journal->records == 0) problem = "has no whole checkpoint";
+    if (problem) {
+        nob_log(NOB_ERROR, "%s %s", path, problem);
+        Journal_File_close(journal);
+        return false;
+    }
+    journal->end = offset;
+    return true;
+}
+
+bool Journal_File_recover(const Journal_File *journal, Grid *grid) {
+    NOB_ASSERT(grid->width == journal->width && grid->height == journal->height && "Journal_File_recover");
+    if (journal->end < journal->data.count) {
+        nob_log(NOB_WARNING, "%s ends with %zu bytes of a torn record, recovering up to tick %"PRIu64,
+                journal->path, journal->data.count - journal->end, journal->tick);
+    }
+    const uint8_t *data = (const uint8_t *)journal->data.items;
+    int chunks = grid->chunks_x * grid->chunks_y;
+    size_t offset = JOURNAL_HEADER_SIZE;
+    for (size_t record = 0; record < journal->records; ++record) {
+        const uint8_t *header = data + offset;
+        size_t size = World_get_le(header + 16, 8);
+        const uint8_t *payload = header + JOURNAL_RECORD_HEADER_SIZE;
+        size_t cursor = 0;
+        bool ok = true;
+        for (uint32_t i = World_get_le(header + 4, 4); ok && i > 0; --i) {
+            uint64_t chunk, length;
+            ok = Journal_get_varint(payload, size, &cursor, &chunk) && chunk < (uint64_t)chunks && cursor + 2 <= size;
+            if (!ok) break;
+            World_Chunk info = { .encoding = payload[cursor], .type = payload[cursor + 1] };
+            cursor += 2;
+            ok = Journal_get_varint(payload, size, &cursor, &length) && length <= size - cursor;
+            if (!ok) break;
+            info.size = length;
+            // The grid starts empty, only the chunks of deltas have anything to clear.
+            if (header[0] == JOURNAL_DELTA) Grid_clear_chunk(grid, chunk);
+            if (info.encoding != WORLD_CHUNK_UNIFORM || info.type != CELL_TYPE_NONE) {
+                ok = World_decode_chunk(grid, chunk, info, payload + cursor);
+            }
+            cursor += length;
+        }
+        if (!ok || cursor != size) {
+            nob_log(NOB_ERROR, "%s: record %zu is broken", journal->path, record);
+            return false;
+        }
+        offset += JOURNAL_RECORD_HEADER_SIZE + size;
+    }
+    nob_log(NOB_INFO, "Recovered %s up to tick %"PRIu64" from a checkpoint and %zu deltas",
+            journal->path, journal->tick, journal->records - 1);
+    return true;
+}
+
+void Journal_File_close(Journal_File *journal) {
+    nob_sb_free(journal->data);
+    *journal = (Journal_File) {0};
+}
+
+#endif // JOURNAL_IMPLEMENTATION
+
+#endif // JOURNAL_H_
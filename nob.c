@@ -5,28 +5,59 @@
 #define BUILD_DIR "build"
 #define BIN_PATH BUILD_DIR"/game"
 #define SRC_PATH "game.c"
+#define BENCH_BIN_PATH BUILD_DIR"/bench"
+#define BENCH_SRC_PATH "bench.c"
 
-bool build_game(Cmd*cmd) {
+// `profile` compiles in the frame profiler, the tracer, the simulation counters and the
+// hardware counters, see profile.h, trace.h, Sim_Counters in sim.h and perf.h.
+bool build_game(Cmd*cmd, bool profile) {
     nob_cc(cmd);
     nob_cc_inputs(cmd, SRC_PATH);
     nob_cc_output(cmd, BIN_PATH);
     nob_cc_flags(cmd);
+    if(profile) cmd_append(cmd, "-DPROFILE", "-DTRACE", "-DSIM_COUNTERS", "-DPERF");
     cmd_append(cmd, "-lraylib", "-lGL", "-lm", "-lpthread", "-ldl", "-lrt", "-lX11");
     return cmd_run_sync_and_reset(cmd);
 }
 
+// Headless simulator, does not need raylib. Always optimized so results are comparable.
+// `perf` adds the hardware counters of perf.h to the report.
+bool build_bench(Cmd*cmd, bool perf) {
+    nob_cc(cmd);
+    nob_cc_inputs(cmd, BENCH_SRC_PATH);
+    nob_cc_output(cmd, BENCH_BIN_PATH);
+    nob_cc_flags(cmd);
+    if(perf) cmd_append(cmd, "-DPERF");
+    cmd_append(cmd, "-O2", "-lm", "-lpthread");
+    return cmd_run_sync_and_reset(cmd);
+}
+
 int main(int argc, char** argv) {
     NOB_GO_REBUILD_URSELF(argc, argv);
     Cmd cmd = {0};
 
+    shift(argv, argc);
     if(!mkdir_if_not_exists(BUILD_DIR)) return 1;
-    if(!build_game(&cmd)) return 1;
 
-    if(argc <= 1) return 0;
+    // `./nob bench [options]` builds and runs the benchmark, forwarding the options.
+    // `./nob perf [options]` does the same with the hardware counters.
+    if(argc > 0 && (strcmp(argv[0], "bench") == 0 || strcmp(argv[0], "perf") == 0)) {
+        bool perf = strcmp(shift(argv, argc), "perf") == 0;
+        if(!build_bench(&cmd, perf)) return 1;
+        cmd_append(&cmd, BENCH_BIN_PATH);
+        da_append_many(&cmd, argv, argc);
+        return cmd_run_sync_and_reset(&cmd) ? 0 : 1;
+    }
+
+    // `./nob profile` builds and runs the game with the profiler.
+    bool profile = argc > 0 && strcmp(argv[0], "profile") == 0;
+    if(!build_game(&cmd, profile)) return 1;
+
+    if(argc <= 0) return 0;
 
     const char* arg = shift(argv, argc);
 
-    if(strcmp(arg, "run")) {
+    if(strcmp(arg, "run") == 0 || profile) {
         cmd_append(&cmd, BIN_PATH);
         if(!cmd_run_sync_and_reset(&cmd)) return 1;
     }
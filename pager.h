@@ -0,0 +1,223 @@
+#ifndef PAGER_H_
+#define PAGER_H_
+// Evicts the cold parts of a paged grid, see Grid_init_paged. The planes are a shared
+// mapping of a file, so the kernel already writes out pages and faults them back in on
+// its own, but it has no idea which pages the simulation is done with until memory runs
+// short. Every scan, chunks that were not woken since the previous scan age by one, and
+// those that stayed asleep for PAGER_IDLE_SCANS scans, along with their neighbours, are
+// written back and dropped, with the pages of their Chunk. Rows are laid out whole, so a
+// page of a plane spans many chunks side by side and only goes once all of them are idle.
+// A cold chunk that wakes up again, or that the renderer or a save reads, simply faults
+// its pages back in. Define PAGER_IMPLEMENTATION in exactly one translation unit before
+// including this file.
+#include "sim.h"
+
+// Ticks between scans, and scans a chunk stays asleep before its pages are dropped.
+#define PAGER_SCAN_TICKS 256
+#define PAGER_IDLE_SCANS 4
+
+typedef struct {
+    uint64_t version;  // Grid::version of the previous scan, chunks woken since are stamped newer
+    uint8_t *idle;     // scans every chunk has been asleep, saturating
+    bool *evicted;     // chunks whose pages were dropped and not touched since
+    int *hot;          // per band of chunks, prefix counts of the chunks that cannot go
+    int *fresh;        // same for the chunks that just went cold
+    size_t page;
+    size_t scans;
+    size_t paged_out;  // bytes of the mapping dropped so far
+} Pager;
+
+void Pager_init(Pager *pager, Grid *grid);
+// Ages the chunks and drops the pages of the ones that went cold. Nothing runs on the
+// grid meanwhile. Returns the bytes dropped.
+size_t Pager_scan(Pager *pager, Grid *grid);
+// Bytes of the mapping currently in memory.
+size_t Pager_resident(const Pager *pager, const Grid *grid);
+void Pager_free(Pager *pager);
+
+#ifdef PAGER_IMPLEMENTATION
+
+#include <sys/mman.h>
+
+// Not in every libc yet, Linux 5.4 and later.
+#ifndef MADV_PAGEOUT
+#define MADV_PAGEOUT 21
+#endif
+
+void Pager_init(Pager *pager, Grid *grid) {
+    NOB_ASSERT(grid->mapping && "Pager_init needs a grid from Grid_init_paged");
+    size_t chunks = (size_t)grid->chunks_x * grid->chunks_y;
+    size_t prefixes = (size_t)(grid->chunks_x + 1) * grid->chunks_y;
+    *pager = (Pager) {
+        .version = grid->version,
+        .idle = calloc(chunks, sizeof(*pager->idle)),
+        .evicted = calloc(chunks, sizeof(*pager->evicted)),
+        .hot = malloc(prefixes * sizeof(*pager->hot)),
+        .fresh = malloc(prefixes * sizeof(*pager->fresh)),
+        .page = sysconf(_SC_PAGESIZE),
+    };
+    unwrap_null(pager->idle);
+    unwrap_null(pager->evicted);
+    unwrap_null(pager->hot);
+    unwrap_null(pager->fresh);
+    grid->version++;
+}
+
+void Pager_free(Pager *pager) {
+    free(pager->idle);
+    free(pager->evicted);
+    free(pager->hot);
+    free(pager->fresh);
+    *pager = (Pager) {0};
+}
+
+// Chunks of band `cy` in columns [cx0, cx1] counted by `prefix`.
+static inline int Pager_count(const int *prefix, const Grid *grid, int cy, int cx0, int cx1) {
+    const int *band = prefix + (size_t)cy * (grid->chunks_x + 1);
+    return band[cx1 + 1] - band[cx0];
+}
+
+// Whether page `index` of a plane can go, and whether it holds a chunk that just went cold.
+static void Pager_classify(const Pager *pager, const Grid *grid, size_t index, bool *cold, bool *fresh) {
+    size_t first = index * pager->page, last = first + pager->page - 1;
+    if (last >= grid->count) last = grid->count - 1;
+    // Halo cells belong to the chunks next to them.
+    int row0 = (int)(first / grid->stride) - 1, row1 = (int)(last / grid->stride) - 1;
+    row0 = row0 < 0 ? 0 : row0 >= grid->height ? grid->height - 1 : row0;
+    row1 = row1 < 0 ? 0 : row1 >= grid->height ? grid->height - 1 : row1;
+    int cx0 = 0, cx1 = grid->chunks_x - 1;
+    if (row0 == row1 && last / grid->stride == first / grid->stride) {
+        int col0 = (int)(first % grid->stride) - 1, col1 = (int)(last % grid->stride) - 1;
+        cx0 = (col0 < 0 ? 0 : col0 >= grid->width ? grid->width - 1 : col0) / CHUNK_SIZE;
+        cx1 = (col1 < 0 ? 0 : col1 >= grid->width ? grid->width - 1 : col1) / CHUNK_SIZE;
+    }
+    *cold = true;
+    *fresh = false;
+    for (int cy = row0 / CHUNK_SIZE; cy <= row1 / CHUNK_SIZE && *cold; ++cy) {
+        *cold = Pager_count(pager->hot, grid, cy, cx0, cx1) == 0;
+        *fresh = *fresh || Pager_count(pager->fresh, grid, cy, cx0, cx1) > 0;
+    }
+}
+
+// Writes back and drops `size` bytes at `offset` of the mapping.
+static void Pager_drop(Pager *pager, Grid *grid, size_t offset, size_t size) {
+    uint8_t *start = (uint8_t *)grid->mapping + offset;
+    // Reclaim skips dirty file pages, they have to be clean first.
+    msync(start, size, MS_SYNC);
+    if (madvise(start, size, MADV_PAGEOUT) != 0) {
+        // Older kernels: unmap the clean pages, the page cache lets go of them first.
+        madvise(start, size, MADV_DONTNEED);
+    }
+    pager->paged_out += size;
+}
+
+static inline bool Pager_is_cold(const Pager *pager, const Grid *grid, int chunk) {
+    return Pager_count(pager->hot, grid, chunk / grid->chunks_x, chunk % grid->chunks_x, chunk % grid->chunks_x) == 0;
+}
+
+// Drops the pages of a plane over the rows of band `cy`, halo included, from page `*next`
+// on, in runs of pages that are all cold with at least one chunk that was not dropped yet.
+static void Pager_drop_band(Pager *pager, Grid *grid, size_t plane, int cy, size_t *next) {
+    int row0 = cy * CHUNK_SIZE - (cy == 0), row1 = cy == grid->chunks_y - 1 ? grid->height : (cy + 1) * CHUNK_SIZE - 1;
+    size_t first = Grid_index(grid, -1, row0) / pager->page, last = Grid_index(grid, grid->width, row1) / pager->page;
+    if (first < *next) first = *next;
+    size_t run = 0, run_length = 0;
+    bool run_fresh = false;
+    for (size_t index = first; index <= last + 1; ++index) {
+        bool cold = false, fresh = false;
+        if (index <= last) Pager_classify(pager, grid, index, &cold, &fresh);
+        if (cold) {
+            if (run_length == 0) run = index;
+            run_length++;
+            run_fresh = run_fresh || fresh;
+            continue;
+        }
+        if (run_length > 0 && run_fresh) Pager_drop(pager, grid, plane + run * pager->page, run_length * pager->page);
+        run_length = 0;
+        run_fresh = false;
+    }
+    *next = last + 1;
+}
+
+size_t Pager_scan(Pager *pager, Grid *grid) {
+    pager->scans++;
+    int chunks_x = grid->chunks_x, chunks_y = grid->chunks_y;
+    for (int i = 0; i < chunks_x * chunks_y; ++i) {
+        bool woken = atomic_load_explicit(&grid->changed_at[i], memory_order_relaxed) > pager->version;
+        if (woken) {
+            pager->idle[i] = 0;
+            pager->evicted[i] = false;
+        } else if (pager->idle[i] < UINT8_MAX) {
+            pager->idle[i]++;
+        }
+    }
+    pager->version = grid->version;
+    grid->version++;
+
+    // A chunk goes once it and every neighbour, whose cells reach into it, are idle.
+    for (int cy = 0; cy < chunks_y; ++cy) {
+        int *hot = pager->hot + (size_t)cy * (chunks_x + 1), *fresh = pager->fresh + (size_t)cy * (chunks_x + 1);
+        hot[0] = fresh[0] = 0;
+        for (int cx = 0; cx < chunks_x; ++cx) {
+            bool idle = true;
+            for (int y = cy > 0 ? cy - 1 : 0; y <= cy + 1 && y < chunks_y; ++y) {
+                for (int x = cx > 0 ? cx - 1 : 0; x <= cx + 1 && x < chunks_x; ++x) {
+                    idle = idle && pager->idle[x + y * chunks_x] >= PAGER_IDLE_SCANS;
+                }
+            }
+            size_t index = cx + (size_t)cy * chunks_x;
+            hot[cx + 1] = hot[cx] + !idle;
+            fresh[cx + 1] = fresh[cx] + (idle && !pager->evicted[index]);
+        }
+    }
+
+    // Only the bands with chunks that just went cold are walked, the pages of the others
+    // either stayed in use or were dropped already, and whatever the kernel read back in
+    // since it reclaims on its own.
+    size_t before = pager->paged_out;
+    size_t type_offset = grid->types - (uint8_t *)grid->mapping, epoch_offset = grid->epochs - (uint8_t *)grid->mapping;
+    size_t next_type = 0, next_epoch = 0, next_chunk = grid->chunks_offset;
+    for (int cy = 0; cy < chunks_y; ++cy) {
+        if (Pager_count(pager->fresh, grid, cy, 0, chunks_x - 1) == 0) continue;
+        Pager_drop_band(pager, grid, type_offset, cy, &next_type);
+        Pager_drop_band(pager, grid, epoch_offset, cy, &next_epoch);
+        // A chunk shares the pages at its ends with the chunks before and after it.
+        for (int cx = 0; cx < chunks_x; ++cx) {
+            int chunk = cx + cy * chunks_x;
+            if (Pager_count(pager->fresh, grid, cy, cx, cx) == 0) continue;
+            size_t begin = grid->chunks_offset + (size_t)chunk * sizeof(Chunk), end = begin + sizeof(Chunk);
+            begin = begin / pager->page * pager->page;
+            end = (end + pager->page - 1) / pager->page * pager->page;
+            if (begin < next_chunk) begin = next_chunk;
+            if (begin >= end) continue;
+            int overlap0 = (begin - grid->chunks_offset) / sizeof(Chunk);
+            int overlap1 = (end - 1 - grid->chunks_offset) / sizeof(Chunk);
+            if (overlap1 >= chunks_x * chunks_y) overlap1 = chunks_x * chunks_y - 1;
+            bool cold = true;
+            for (int other = overlap0; other <= overlap1 && cold; ++other) cold = Pager_is_cold(pager, grid, other);
+            if (!cold) continue;
+            Pager_drop(pager, grid, begin, end - begin);
+            next_chunk = end;
+        }
+        for (int cx = 0; cx < chunks_x; ++cx) {
+            if (Pager_count(pager->hot, grid, cy, cx, cx) == 0) pager->evicted[cx + cy * chunks_x] = true;
+        }
+    }
+    return pager->paged_out - before;
+}
+
+size_t Pager_resident(const Pager *pager, const Grid *grid) {
+    size_t pages = grid->mapping_size / pager->page;
+    unsigned char *vector = malloc(pages);
+    unwrap_null(vector);
+    size_t resident = 0;
+    if (mincore(grid->mapping, grid->mapping_size, vector) == 0) {
+        for (size_t i = 0; i < pages; ++i) resident += vector[i] & 1;
+    }
+    free(vector);
+    return resident * pager->page;
+}
+
+#endif // PAGER_IMPLEMENTATION
+
+#endif // PAGER_H_
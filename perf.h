@@ -0,0 +1,239 @@
+#ifndef PERF_H_
+#define PERF_H_
+// Hardware performance counters of the calling thread through Linux perf_event_open:
+// cycles, instructions, L1 data and last level cache misses and branch misses, plus the
+// thread's CPU time. Every thread opens its own group of counters the first time it reads
+// them and reads them all with one syscall. Needs no tools, only a kernel that lets users
+// count their own threads (kernel.perf_event_paranoid <= 2, the default). Counters the
+// machine does not have, as in most VMs, read as 0 and are left out of Perf_available.
+// Compiled in with PERF. Define PERF_IMPLEMENTATION in exactly one translation unit
+// before including this file.
+#include <inttypes.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#ifndef NOB_H_
+#include "nob.h"
+#endif
+
+#if defined(PERF) && !defined(__linux__)
+#error "PERF reads the counters through perf_event_open, which only Linux has"
+#endif
+
+typedef enum {
+    PERF_CYCLES,
+    PERF_INSTRUCTIONS,
+    PERF_L1D_MISSES,    // L1 data cache read misses
+    PERF_LLC_MISSES,    // last level cache misses
+    PERF_BRANCH_MISSES,
+    PERF_TASK_CLOCK,    // nanoseconds on a CPU, a software counter that is always there
+    PERF_COUNTER_COUNT,
+} Perf_Counter;
+
+typedef struct {
+    uint64_t values[PERF_COUNTER_COUNT];
+} Perf_Counts;
+
+#ifdef PERF
+
+extern const char *Perf_Counter_names[PERF_COUNTER_COUNT];
+// Bit 1 << counter for every counter that some thread could open.
+extern atomic_uint Perf_available;
+
+// Counts of the calling thread since its counters were opened, opening them on the first call.
+Perf_Counts Perf_read(void);
+// Closes the counters of the calling thread, before it exits.
+void Perf_thread_stop(void);
+
+// Adds `end - start` to `sum`.
+static inline void Perf_Counts_add_since(Perf_Counts *sum, const Perf_Counts *start, const Perf_Counts *end) {
+    for (size_t i = 0; i < PERF_COUNTER_COUNT; ++i) sum->values[i] += end->values[i] - start->values[i];
+}
+
+static inline void Perf_Counts_add(Perf_Counts *sum, const Perf_Counts *counts, uint64_t scale) {
+    for (size_t i = 0; i < PERF_COUNTER_COUNT; ++i) sum->values[i] += counts->values[i] * scale;
+}
+
+// Same, minus what one read of the counters costs the calling thread, for spans so short
+// that the read would weigh on them.
+void Perf_Counts_add_span(Perf_Counts *sum, const Perf_Counts *start, const Perf_Counts *end);
+
+// Writes the counts as a JSON object with instructions per cycle and events per cell,
+// null for the counters this machine does not have.
+void Perf_Counts_json(FILE *file, const Perf_Counts *counts, double cells);
+// Logs the counts of a zone on one line.
+void Perf_Counts_log(const char *zone, const Perf_Counts *counts, double cells);
+
+#endif // PERF
+
+#ifdef PERF_IMPLEMENTATION
+#ifdef PERF
+
+#include <errno.h>
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+const char *Perf_Counter_names[PERF_COUNTER_COUNT] = {
+    [PERF_CYCLES] = "cycles",
+    [PERF_INSTRUCTIONS] = "instructions",
+    [PERF_L1D_MISSES] = "l1d_misses",
+    [PERF_LLC_MISSES] = "llc_misses",
+    [PERF_BRANCH_MISSES] = "branch_misses",
+    [PERF_TASK_CLOCK] = "task_clock_ns",
+};
+
+atomic_uint Perf_available;
+
+static const struct { uint32_t type; uint64_t config; } Perf_Counter_events[PERF_COUNTER_COUNT] = {
+    [PERF_CYCLES] = { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+    [PERF_INSTRUCTIONS] = { PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+    [PERF_L1D_MISSES] = { PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+                                              (PERF_COUNT_HW_CACHE_RESULT_MISS << 16) },
+    [PERF_LLC_MISSES] = { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES },
+    [PERF_BRANCH_MISSES] = { PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES },
+    [PERF_TASK_CLOCK] = { PERF_TYPE_SOFTWARE, PERF_COUNT_SW_TASK_CLOCK },
+};
+
+// Group of counters of one thread, read together so they all cover the same instructions.
+typedef struct {
+    bool opened;
+    int leader;                   // group fd, -1 when no counter could be opened
+    int fds[PERF_COUNTER_COUNT];  // -1 for the counters this machine does not have
+    int slots[PERF_COUNTER_COUNT]; // position of each counter in a group read
+    int count;                    // counters in the group
+    Perf_Counts read_cost;        // counted between two reads in a row, the cheapest of a few
+} Perf_Thread;
+
+static _Thread_local Perf_Thread perf_thread;
+static atomic_bool perf_warned;
+
+static Perf_Counts Perf_read_group(const Perf_Thread *thread) {
+    Perf_Counts counts = {0};
+    if (thread->leader < 0) return counts;
+
+    struct {
+        uint64_t count, time_enabled, time_running;
+        uint64_t values[PERF_COUNTER_COUNT];
+    } group;
+    ssize_t size = read(thread->leader, &group, sizeof(group));
+    if (size < (ssize_t)(3 * sizeof(uint64_t)) || group.count != (uint64_t)thread->count) return counts;
+    // When the kernel had to multiplex the counters, extrapolate to the whole time they were enabled.
+    double scale = group.time_running && group.time_running < group.time_enabled
+        ? (double)group.time_enabled / group.time_running : 1.0;
+    for (size_t i = 0; i < PERF_COUNTER_COUNT; ++i) {
+        if (thread->slots[i] >= 0) counts.values[i] = group.values[thread->slots[i]] * scale;
+    }
+    return counts;
+}
+
+static void Perf_thread_start(void) {
+    Perf_Thread *thread = &perf_thread;
+    *thread = (Perf_Thread) { .opened = true, .leader = -1 };
+    unsigned available = 0;
+    char missing[256] = {0};
+    int error = 0;
+    for (size_t i = 0; i < PERF_COUNTER_COUNT; ++i) {
+        struct perf_event_attr attr = {
+            .size = sizeof(attr),
+            .type = Perf_Counter_events[i].type,
+            .config = Perf_Counter_events[i].config,
+            .read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING,
+            .exclude_kernel = 1, // all an unprivileged user may count
+            .exclude_hv = 1,
+        };
+        thread->fds[i] = syscall(SYS_perf_event_open, &attr, 0, -1, thread->leader, 0);
+        thread->slots[i] = -1;
+        if (thread->fds[i] < 0) {
+            error = errno;
+            size_t n = strlen(missing);
+            snprintf(missing + n, sizeof(missing) - n, "%s%s", n ? ", " : "", Perf_Counter_names[i]);
+            continue;
+        }
+        if (thread->leader < 0) thread->leader = thread->fds[i];
+        thread->slots[i] = thread->count++;
+        available |= 1u << i;
+    }
+    atomic_fetch_or(&Perf_available, available);
+
+    if (thread->leader >= 0) {
+        for (size_t i = 0; i < PERF_COUNTER_COUNT; ++i) thread->read_cost.values[i] = UINT64_MAX;
+        Perf_Counts previous = Perf_read_group(thread);
+        for (int i = 0; i < 16; ++i) {
+            Perf_Counts now = Perf_read_group(thread);
+            for (size_t j = 0; j < PERF_COUNTER_COUNT; ++j) {
+                uint64_t cost = now.values[j] - previous.values[j];
+                if (cost < thread->read_cost.values[j]) thread->read_cost.values[j] = cost;
+            }
+            previous = now;
+        }
+    }
+    // Every thread gets the same answer, once is enough.
+    if (missing[0] && !atomic_exchange(&perf_warned, true)) {
+        nob_log(NOB_WARNING, "Could not open the %s counters: %s, they read as 0", missing, strerror(error));
+    }
+}
+
+Perf_Counts Perf_read(void) {
+    if (!perf_thread.opened) Perf_thread_start();
+    return Perf_read_group(&perf_thread);
+}
+
+void Perf_Counts_add_span(Perf_Counts *sum, const Perf_Counts *start, const Perf_Counts *end) {
+    for (size_t i = 0; i < PERF_COUNTER_COUNT; ++i) {
+        uint64_t counted = end->values[i] - start->values[i];
+        uint64_t cost = perf_thread.read_cost.values[i];
+        sum->values[i] += counted > cost ? counted - cost : 0;
+    }
+}
+
+void Perf_thread_stop(void) {
+    Perf_Thread *thread = &perf_thread;
+    if (!thread->opened) return;
+    for (size_t i = 0; i < PERF_COUNTER_COUNT; ++i) {
+        if (thread->fds[i] >= 0) close(thread->fds[i]);
+    }
+    *thread = (Perf_Thread) {0};
+}
+
+static bool Perf_is_available(Perf_Counter counter) {
+    return atomic_load(&Perf_available) & (1u << counter);
+}
+
+void Perf_Counts_json(FILE *file, const Perf_Counts *counts, double cells) {
+    fprintf(file, "{");
+    for (size_t i = 0; i < PERF_COUNTER_COUNT; ++i) {
+        if (Perf_is_available(i)) fprintf(file, "\"%s\": %" PRIu64 ", ", Perf_Counter_names[i], counts->values[i]);
+        else fprintf(file, "\"%s\": null, ", Perf_Counter_names[i]);
+    }
+    if (Perf_is_available(PERF_CYCLES) && Perf_is_available(PERF_INSTRUCTIONS) && counts->values[PERF_CYCLES]) {
+        fprintf(file, "\"ipc\": %.3f", (double)counts->values[PERF_INSTRUCTIONS] / counts->values[PERF_CYCLES]);
+    } else {
+        fprintf(file, "\"ipc\": null");
+    }
+    for (size_t i = 0; i < PERF_COUNTER_COUNT; ++i) {
+        if (i == PERF_TASK_CLOCK) continue;
+        if (Perf_is_available(i) && cells > 0) fprintf(file, ", \"%s_per_cell\": %.5f", Perf_Counter_names[i], counts->values[i] / cells);
+        else fprintf(file, ", \"%s_per_cell\": null", Perf_Counter_names[i]);
+    }
+    fprintf(file, "}");
+}
+
+void Perf_Counts_log(const char *zone, const Perf_Counts *counts, double cells) {
+    char line[512];
+    int n = snprintf(line, sizeof(line), "    %-8s cpu %.1f ms", zone, counts->values[PERF_TASK_CLOCK] / 1e6);
+    if (Perf_is_available(PERF_CYCLES) && Perf_is_available(PERF_INSTRUCTIONS) && counts->values[PERF_CYCLES]) {
+        n += snprintf(line + n, sizeof(line) - n, ", ipc %.2f",
+                      (double)counts->values[PERF_INSTRUCTIONS] / counts->values[PERF_CYCLES]);
+    }
+    for (size_t i = 0; i < PERF_TASK_CLOCK && n >= 0 && (size_t)n < sizeof(line) && cells > 0; ++i) {
+        if (Perf_is_available(i)) n += snprintf(line + n, sizeof(line) - n, ", %s/cell %.4f", Perf_Counter_names[i], counts->values[i] / cells);
+    }
+    nob_log(NOB_INFO, "%s", line);
+}
+
+#endif // PERF
+#endif // PERF_IMPLEMENTATION
+
+#endif // PERF_H_
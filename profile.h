@@ -0,0 +1,191 @@
+#ifndef PROFILE_H_
+#define PROFILE_H_
+// Frame profiler: scoped timers around the subsystems of a frame and the element passes
+// of a tick, kept as rolling averages and p99s, with an optional per-frame CSV dump.
+// Everything compiles to nothing unless PROFILE is defined. Define PROFILE_IMPLEMENTATION
+// in exactly one translation unit before including this file.
+#include "sim.h"
+
+typedef enum {
+    PROFILE_ZONE_FRAME,    // a whole frame of the main loop
+    PROFILE_ZONE_INPUT,    // keyboard, mouse and view controls
+    PROFILE_ZONE_RENDER,   // syncing the newest snapshot and refilling the texture
+    PROFILE_ZONE_DRAW,     // issuing the draw calls and presenting
+    PROFILE_ZONE_TICK,     // a whole simulation tick, on the simulation thread
+    PROFILE_ZONE_PUBLISH,  // copying a tick into a snapshot
+    PROFILE_ZONE_UPDATE,   // the passes of every element, one zone per active type
+    PROFILE_ZONE_COUNT = PROFILE_ZONE_UPDATE + ACTIVE_TYPE_COUNT,
+} Profile_Zone;
+
+// Samples kept per zone for the rolling statistics.
+#define PROFILE_HISTORY 240
+
+#ifdef PROFILE
+
+extern const char *Profile_Zone_names[PROFILE_ZONE_COUNT];
+
+typedef struct {
+    double samples[PROFILE_ZONE_COUNT][PROFILE_HISTORY]; // milliseconds, rolling
+    size_t counts[PROFILE_ZONE_COUNT];                   // samples ever recorded
+    double last[PROFILE_ZONE_COUNT];                     // newest sample
+    pthread_mutex_t mutex; // zones are recorded from the main and the simulation thread
+
+    FILE *csv;             // per-frame dump, NULL when off
+    size_t csv_frames;
+} Profile;
+
+typedef struct {
+    double avg_ms, p99_ms;
+} Profile_Summary;
+
+void Profile_init(Profile *profile);
+void Profile_free(Profile *profile);
+void Profile_record(Profile *profile, Profile_Zone zone, double ms);
+// Records a zone from `start_ns` to `end_ns`, also on the trace when built with TRACE.
+void Profile_span(Profile *profile, Profile_Zone zone, uint64_t start_ns, uint64_t end_ns);
+// Records the element passes of a tick, CPU time summed over the workers.
+void Profile_record_tick(Profile *profile, const Tick_Stats *stats);
+Profile_Summary Profile_summarize(Profile *profile, Profile_Zone zone);
+bool Profile_csv_start(Profile *profile, const char *path);
+void Profile_csv_stop(Profile *profile);
+// Appends the newest sample of every zone as one row, when the dump is on.
+void Profile_csv_frame(Profile *profile);
+
+// Times the statement or block that follows:
+//
+//     PROFILE_SCOPE(&profile, PROFILE_ZONE_INPUT) {
+//         ...
+//     }
+//
+// The block is the body of a loop: `break` and `continue` inside it leave the scope, and
+// leaving it with goto or return skips the sample.
+#define PROFILE_SCOPE(profile, zone) \
+    for (uint64_t profile_start_ = time_now_ns(), profile_once_ = 1; profile_once_; \
+         profile_once_ = 0, Profile_span((profile), (zone), profile_start_, time_now_ns()))
+
+// For spans that are not a single block: PROFILE_MARK(start) ... PROFILE_SINCE(&profile, zone, start).
+#define PROFILE_MARK(name) uint64_t name = time_now_ns()
+#define PROFILE_SINCE(profile, zone, name) Profile_span((profile), (zone), (name), time_now_ns())
+
+#else
+
+#define PROFILE_SCOPE(profile, zone)
+#define PROFILE_MARK(name)
+#define PROFILE_SINCE(profile, zone, name)
+
+#endif // PROFILE
+
+#ifdef PROFILE_IMPLEMENTATION
+#ifdef PROFILE
+
+const char *Profile_Zone_names[PROFILE_ZONE_COUNT] = {
+    [PROFILE_ZONE_FRAME] = "frame",
+    [PROFILE_ZONE_INPUT] = "input",
+    [PROFILE_ZONE_RENDER] = "render",
+    [PROFILE_ZONE_DRAW] = "draw",
+    [PROFILE_ZONE_TICK] = "tick",
+    [PROFILE_ZONE_PUBLISH] = "publish",
+    [PROFILE_ZONE_UPDATE + CELL_TYPE_SAND - ACTIVE_TYPE_FIRST] = "sand",
+    [PROFILE_ZONE_UPDATE + CELL_TYPE_WATER - ACTIVE_TYPE_FIRST] = "water",
+    [PROFILE_ZONE_UPDATE + CELL_TYPE_OIL - ACTIVE_TYPE_FIRST] = "oil",
+    [PROFILE_ZONE_UPDATE + CELL_TYPE_LIFE - ACTIVE_TYPE_FIRST] = "life",
+    [PROFILE_ZONE_UPDATE + CELL_TYPE_SEED - ACTIVE_TYPE_FIRST] = "seed",
+    [PROFILE_ZONE_UPDATE + CELL_TYPE_FIRE - ACTIVE_TYPE_FIRST] = "fire",
+};
+
+void Profile_init(Profile *profile) {
+    *profile = (Profile) {0};
+    pthread_mutex_init(&profile->mutex, NULL);
+}
+
+void Profile_free(Profile *profile) {
+    Profile_csv_stop(profile);
+    pthread_mutex_destroy(&profile->mutex);
+}
+
+static void Profile_record_locked(Profile *profile, Profile_Zone zone, double ms) {
+    profile->samples[zone][profile->counts[zone]++ % PROFILE_HISTORY] = ms;
+    profile->last[zone] = ms;
+}
+
+void Profile_record(Profile *profile, Profile_Zone zone, double ms) {
+    pthread_mutex_lock(&profile->mutex);
+    Profile_record_locked(profile, zone, ms);
+    pthread_mutex_unlock(&profile->mutex);
+}
+
+void Profile_span(Profile *profile, Profile_Zone zone, uint64_t start_ns, uint64_t end_ns) {
+    Profile_record(profile, zone, (end_ns - start_ns) / 1e6);
+#ifdef TRACE
+    Trace_span(Profile_Zone_names[zone], start_ns, end_ns, TRACE_NO_ID);
+#endif
+}
+
+void Profile_record_tick(Profile *profile, const Tick_Stats *stats) {
+    pthread_mutex_lock(&profile->mutex);
+    Profile_record_locked(profile, PROFILE_ZONE_TICK, stats->time_ms);
+    for (size_t i = 0; i < ACTIVE_TYPE_COUNT; ++i) {
+        Profile_record_locked(profile, PROFILE_ZONE_UPDATE + i, stats->pass_ms[i]);
+    }
+    pthread_mutex_unlock(&profile->mutex);
+}
+
+static int Profile_compare_ms(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+Profile_Summary Profile_summarize(Profile *profile, Profile_Zone zone) {
+    double sorted[PROFILE_HISTORY];
+    pthread_mutex_lock(&profile->mutex);
+    size_t count = profile->counts[zone] < PROFILE_HISTORY ? profile->counts[zone] : PROFILE_HISTORY;
+    memcpy(sorted, profile->samples[zone], count * sizeof(*sorted));
+    pthread_mutex_unlock(&profile->mutex);
+    if (count == 0) return (Profile_Summary) {0};
+
+    qsort(sorted, count, sizeof(*sorted), Profile_compare_ms);
+    double sum = 0;
+    for (size_t i = 0; i < count; ++i) sum += sorted[i];
+    size_t rank = (size_t)(0.99 * count + 0.5); // nearest rank
+    if (rank < 1) rank = 1;
+    return (Profile_Summary) { .avg_ms = sum / count, .p99_ms = sorted[rank - 1] };
+}
+
+bool Profile_csv_start(Profile *profile, const char *path) {
+    Profile_csv_stop(profile);
+    profile->csv = fopen(path, "w");
+    if (!profile->csv) {
+        nob_log(NOB_ERROR, "Could not open %s: %s", path, strerror(errno));
+        return false;
+    }
+    profile->csv_frames = 0;
+    fprintf(profile->csv, "frame");
+    for (size_t i = 0; i < PROFILE_ZONE_COUNT; ++i) fprintf(profile->csv, ",%s_ms", Profile_Zone_names[i]);
+    fprintf(profile->csv, "\n");
+    nob_log(NOB_INFO, "Writing a profile of every frame to %s", path);
+    return true;
+}
+
+void Profile_csv_stop(Profile *profile) {
+    if (!profile->csv) return;
+    if (fclose(profile->csv) != 0) nob_log(NOB_ERROR, "Could not write the profile: %s", strerror(errno));
+    else nob_log(NOB_INFO, "Wrote the profile of %zu frames", profile->csv_frames);
+    profile->csv = NULL;
+}
+
+void Profile_csv_frame(Profile *profile) {
+    if (!profile->csv) return;
+    double last[PROFILE_ZONE_COUNT];
+    pthread_mutex_lock(&profile->mutex);
+    memcpy(last, profile->last, sizeof(last));
+    pthread_mutex_unlock(&profile->mutex);
+
+    fprintf(profile->csv, "%zu", profile->csv_frames++);
+    for (size_t i = 0; i < PROFILE_ZONE_COUNT; ++i) fprintf(profile->csv, ",%.4f", last[i]);
+    fprintf(profile->csv, "\n");
+}
+
+#endif // PROFILE
+#endif // PROFILE_IMPLEMENTATION
+
+#endif // PROFILE_H_
@@ -0,0 +1,278 @@
+#ifndef REPLAY_H_
+#define REPLAY_H_
+// Recordings of everything that decides how a run unfolds: the seed, the grid size, the
+// starting scene and every cell placed by hand, with the tick it was placed before. The
+// simulation is deterministic for a given seed whatever the number of threads, so feeding
+// a recording back reproduces the run exactly, at any speed. Define REPLAY_IMPLEMENTATION
+// in exactly one translation unit before including this file.
+//
+// File layout, integers little-endian:
+//
+//     "SBRP", u32 version, u64 seed, u32 width, u32 height, u8 length, scene name
+//     records: varint tick delta, u8 type, then for an edit zigzag varint col delta, row delta
+//
+// The last record has the type REPLAY_END and the tick the recording stopped at. Deltas
+// are to the previous record, so a brush stroke costs a few bytes per cell.
+#include "sim.h"
+
+#define REPLAY_MAGIC "SBRP"
+#define REPLAY_VERSION 1
+#define REPLAY_END 0xFF
+#define REPLAY_SCENE_MAX 64
+
+typedef struct {
+    uint64_t seed;
+    int width, height;
+    char scene[REPLAY_SCENE_MAX]; // empty for an empty world
+} Replay_Header;
+
+typedef struct {
+    uint64_t tick; // ticks done when the edit was applied, it goes in before the next one
+    int col, row;
+    Cell_Type type;
+} Replay_Edit;
+
+// Streams the records to the file as the edits are applied, from a single thread.
+typedef struct {
+    FILE *file;
+    const char *path;
+    Nob_String_Builder buffer;   // records not written yet
+    uint64_t tick;           // of the previous record
+    int col, row;            // of the previous edit
+    size_t edits;
+    bool failed;
+} Replay_Recorder;
+
+bool Replay_Recorder_start(Replay_Recorder *recorder, const char *path, const Replay_Header *header);
+void Replay_Recorder_edit(Replay_Recorder *recorder, Replay_Edit edit);
+// Ends the recording at `ticks` and closes the file. Returns false if anything failed to write.
+bool Replay_Recorder_finish(Replay_Recorder *recorder, uint64_t ticks);
+
+typedef struct {
+    Replay_Header header;
+    uint64_t ticks;    // where the recording stopped
+    size_t edits;
+
+    Nob_String_Builder data;
+    size_t records;    // offset of the first record
+    size_t cursor;     // of the next record
+    uint64_t tick;     // decoder state, of the previous record
+    int col, row;
+} Replay;
+
+// Reads and checks the whole file.
+bool Replay_load(Replay *replay, const char *path);
+// Decodes the next edit, returns false after the last one.
+bool Replay_next(Replay *replay, Replay_Edit *edit);
+// Goes back to the first edit.
+void Replay_rewind(Replay *replay);
+void Replay_free(Replay *replay);
+
+#ifdef REPLAY_IMPLEMENTATION
+
+static void Replay_put_u32(Nob_String_Builder *sb, uint32_t value) {
+    for (int i = 0; i < 4; ++i) nob_da_append(sb, (char)(value >> (8 * i)));
+}
+
+static void Replay_put_u64(Nob_String_Builder *sb, uint64_t value) {
+    for (int i = 0; i < 8; ++i) nob_da_append(sb, (char)(value >> (8 * i)));
+}
+
+static void Replay_put_varint(Nob_String_Builder *sb, uint64_t value) {
+    while (value >= 0x80) {
+        nob_da_append(sb, (char)(value | 0x80));
+        value >>= 7;
+    }
+    nob_da_append(sb, (char)value);
+}
+
+static void Replay_put_delta(Nob_String_Builder *sb, int64_t delta) {
+    Replay_put_varint(sb, ((uint64_t)delta << 1) ^ (uint64_t)(delta >> 63)); // zigzag
+}
+
+// Writes out the buffered records once there are enough of them to be worth a write.
+static void Replay_Recorder_flush(Replay_Recorder *recorder, size_t threshold) {
+    if (recorder->buffer.count < threshold) return;
+    if (!recorder->failed && fwrite(recorder->buffer.items, 1, recorder->buffer.count, recorder->file) != recorder->buffer.count) {
+        nob_log(NOB_ERROR, "Could not write %s: %s", recorder->path, strerror(errno));
+        recorder->failed = true;
+    }
+    recorder->buffer.count = 0;
+}
+
+bool Replay_Recorder_start(Replay_Recorder *recorder, const char *path, const Replay_Header *header) {
+    *recorder = (Replay_Recorder) { .path = path };
+    recorder->file = fopen(path, "wb");
+    if (!recorder->file) {
+        nob_log(NOB_ERROR, "Could not open %s: %s", path, strerror(errno));
+        return false;
+    }
+    Nob_String_Builder *sb = &recorder->buffer;
+    nob_sb_append_buf(sb, REPLAY_MAGIC, 4);
+    Replay_put_u32(sb, REPLAY_VERSION);
+    Replay_put_u64(sb, header->seed);
+    Replay_put_u32(sb, header->width);
+    Replay_put_u32(sb, header->height);
+    size_t length = strlen(header->scene);
+    nob_da_append(sb, (char)length);
+    nob_sb_append_buf(sb, header->scene, length);
+    Replay_Recorder_flush(recorder, 0);
+    nob_log(NOB_INFO, "Recording the input to %s", path);
+    return !recorder->failed;
+}
+
+void Replay_Recorder_edit(Replay_Recorder *recorder, Replay_Edit edit) {
+    Nob_String_Builder *sb = &recorder->buffer;
+    Replay_put_varint(sb, edit.tick - recorder->tick);
+    nob_da_append(sb, (char)edit.type);
+    Replay_put_delta(sb, (int64_t)edit.col - recorder->col);
+    Replay_put_delta(sb, (int64_t)edit.row - recorder->row);
+    recorder->tick = edit.tick;
+    recorder->col = edit.col;
+    recorder->row = edit.row;
+    recorder->edits++;
+    Replay_Recorder_flush(recorder, 64 * 1024);
+}
+
+bool Replay_Recorder_finish(Replay_Recorder *recorder, uint64_t ticks) {
+    Replay_put_varint(&recorder->buffer, ticks - recorder->tick);
+    nob_da_append(&recorder->buffer, (char)REPLAY_END);
+    Replay_Recorder_flush(recorder, 0);
+
+    bool ok = fclose(recorder->file) == 0 && !recorder->failed;
+    if (ok) nob_log(NOB_INFO, "Recorded %zu edits over %"PRIu64" ticks to %s", recorder->edits, ticks, recorder->path);
+    else nob_log(NOB_ERROR, "Could not write %s", recorder->path);
+    nob_sb_free(recorder->buffer);
+    *recorder = (Replay_Recorder) {0};
+    return ok;
+}
+
+typedef struct {
+    const uint8_t *data;
+    size_t count, cursor;
+    bool failed;
+} Replay_Reader;
+
+static uint8_t Replay_get_u8(Replay_Reader *reader) {
+    if (reader->cursor >= reader->count) {
+        reader->failed = true;
+        return 0;
+    }
+    return reader->data[reader->cursor++];
+}
+
+static uint64_t Replay_get_le(Replay_Reader *reader, int bytes) {
+    uint64_t value = 0;
+    for (int i = 0; i < bytes; ++i) value |= (uint64_t)Replay_get_u8(reader) << (8 * i);
+    return value;
+}
+
+static uint64_t Replay_get_varint(Replay_Reader *reader) {
+    uint64_t value = 0;
+    for (int shift = 0; shift < 64; shift += 7) {
+        uint8_t byte = Replay_get_u8(reader);
+        value |= (uint64_t)(byte & 0x7F) << shift;
+        if (!(byte & 0x80)) return value;
+    }
+    reader->failed = true;
+    return 0;
+}
+
+static int64_t Replay_get_delta(Replay_Reader *reader) {
+    uint64_t value = Replay_get_varint(reader);
+    return (int64_t)(value >> 1) ^ -(int64_t)(value & 1);
+}
+
+// Decodes one record at `cursor`. Returns false on the end record or a broken one.
+static bool Replay_decode(Replay *replay, Replay_Reader *reader, Replay_Edit *edit, bool *end) {
+    uint64_t tick = replay->tick + Replay_get_varint(reader);
+    uint8_t type = Replay_get_u8(reader);
+    *end = !reader->failed && type == REPLAY_END;
+    if (*end) replay->tick = tick;
+    if (reader->failed || *end) return false;
+    int64_t col = replay->col + Replay_get_delta(reader);
+    int64_t row = replay->row + Replay_get_delta(reader);
+    if (reader->failed || type >= CELL_TYPE_BEDROCK || col < 0 || col >= replay->header.width ||
+        row < 0 || row >= replay->header.height) {
+        reader->failed = true;
+        return false;
+    }
+    *edit = (Replay_Edit) { .tick = tick, .col = col, .row = row, .type = type };
+    replay->tick = tick;
+    replay->col = col;
+    replay->row = row;
+    return true;
+}
+
+bool Replay_load(Replay *replay, const char *path) {
+    *replay = (Replay) {0};
+    if (!nob_read_entire_file(path, &replay->data)) return false;
+
+    Replay_Reader reader = { .data = (const uint8_t *)replay->data.items, .count = replay->data.count };
+    if (reader.count < 4 || memcmp(reader.data, REPLAY_MAGIC, 4) != 0) {
+        nob_log(NOB_ERROR, "%s is not a recording", path);
+        return false;
+    }
+    reader.cursor = 4;
+    uint32_t version = Replay_get_le(&reader, 4);
+    if (version != REPLAY_VERSION) {
+        nob_log(NOB_ERROR, "%s is a version %u recording, only version %d is supported", path, version, REPLAY_VERSION);
+        return false;
+    }
+    Replay_Header *header = &replay->header;
+    header->seed = Replay_get_le(&reader, 8);
+    header->width = Replay_get_le(&reader, 4);
+    header->height = Replay_get_le(&reader, 4);
+    size_t length = Replay_get_u8(&reader);
+    if (reader.failed || length >= REPLAY_SCENE_MAX || reader.cursor + length > reader.count ||
+        header->width < 3 || header->width > GRID_PAGED_SIZE_MAX || header->height < 3 || header->height > GRID_PAGED_SIZE_MAX) {
+        nob_log(NOB_ERROR, "%s has a broken header", path);
+        return false;
+    }
+    memcpy(header->scene, reader.data + reader.cursor, length);
+    header->scene[length] = '\0';
+    reader.cursor += length;
+    replay->records = reader.cursor;
+
+    // Check every record up front, so a replay never stops halfway.
+    Replay_Edit edit;
+    bool end = false;
+    while (Replay_decode(replay, &reader, &edit, &end)) replay->edits++;
+    replay->ticks = replay->tick;
+    if (!end) {
+        // A recording whose game was killed has no end record, keep what made it to disk
+        // and run one more tick so the last edits show.
+        replay->ticks++;
+        nob_log(NOB_WARNING, "%s is cut short after %zu edits, replaying up to tick %"PRIu64, path, replay->edits, replay->ticks);
+    }
+    Replay_rewind(replay);
+    return true;
+}
+
+bool Replay_next(Replay *replay, Replay_Edit *edit) {
+    Replay_Reader reader = {
+        .data = (const uint8_t *)replay->data.items,
+        .count = replay->data.count,
+        .cursor = replay->cursor,
+    };
+    bool end;
+    if (!Replay_decode(replay, &reader, edit, &end)) return false;
+    replay->cursor = reader.cursor;
+    return true;
+}
+
+void Replay_rewind(Replay *replay) {
+    replay->cursor = replay->records;
+    replay->tick = 0;
+    replay->col = 0;
+    replay->row = 0;
+}
+
+void Replay_free(Replay *replay) {
+    nob_sb_free(replay->data);
+    *replay = (Replay) {0};
+}
+
+#endif // REPLAY_IMPLEMENTATION
+
+#endif // REPLAY_H_
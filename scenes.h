@@ -0,0 +1,103 @@
+#ifndef SCENES_H_
+#define SCENES_H_
+// Deterministic starting worlds, shared by the benchmark and the game's -scene option.
+// Define SCENES_IMPLEMENTATION in exactly one translation unit before including this file.
+#include "sim.h"
+
+// Scenes only use the scene rng, so every run of a scene starts from the same world.
+typedef void (*Scene_Fn)(Grid *grid, Rng *rng);
+
+typedef struct {
+    const char *name;
+    Scene_Fn setup;
+} Scene;
+
+#define SCENES_COUNT 5
+extern const Scene scenes[SCENES_COUNT];
+
+// Returns NULL when there is no scene with that name.
+const Scene *Scene_find(const char *name);
+
+#ifdef SCENES_IMPLEMENTATION
+
+static void Scene_fill(Grid *grid, int min_x, int min_y, int max_x, int max_y, Cell_Type type) {
+    for (int row = min_y; row <= max_y; ++row) {
+        for (int col = min_x; col <= max_x; ++col) {
+            Grid_set_type(grid, Grid_index(grid, col, row), type);
+        }
+    }
+}
+
+// Scatters `type` over the empty cells of a rectangle, with a chance of one in `one_in`.
+static void Scene_scatter(Grid *grid, Rng *rng, int min_x, int min_y, int max_x, int max_y, Cell_Type type, uint32_t one_in) {
+    for (int row = min_y; row <= max_y; ++row) {
+        for (int col = min_x; col <= max_x; ++col) {
+            size_t pos = Grid_index(grid, col, row);
+            if (grid->types[pos] == CELL_TYPE_NONE && Rng_range(rng, one_in) == 0) Grid_set_type(grid, pos, type);
+        }
+    }
+}
+
+// A loose pile of sand over staggered rock ledges.
+static void Scene_sand_avalanche(Grid *grid, Rng *rng) {
+    int w = grid->width, h = grid->height;
+    for (int ledge = 0; ledge < 8; ++ledge) {
+        int row = h / 3 + ledge * (h * 2 / 3) / 8;
+        int min_x = (ledge % 2) ? w / 3 : 0;
+        Scene_fill(grid, min_x, row, min_x + w * 2 / 3 - 1, row, CELL_TYPE_ROCK);
+    }
+    Scene_scatter(grid, rng, 0, 0, w - 1, h / 3 - 1, CELL_TYPE_SAND, 2);
+}
+
+// A lake above a stepped rock basin, breaking through a gap in its floor.
+static void Scene_flood(Grid *grid, Rng *rng) {
+    int w = grid->width, h = grid->height;
+    for (int step = 0; step < 4; ++step) {
+        int row = h - 1 - step * h / 16;
+        Scene_fill(grid, step * w / 8, row, w - 1 - step * w / 8, h - 1, CELL_TYPE_ROCK);
+    }
+    Scene_fill(grid, 0, h / 2, w / 2 - 2, h / 2, CELL_TYPE_ROCK);
+    Scene_fill(grid, w / 2 + 2, h / 2, w - 1, h / 2, CELL_TYPE_ROCK);
+    Scene_fill(grid, 0, 0, w - 1, h / 2 - 1, CELL_TYPE_WATER);
+    Scene_scatter(grid, rng, 0, h / 2 + 1, w - 1, h - 1, CELL_TYPE_SAND, 32);
+}
+
+// A pool of oil lit along its surface, with floating seeds to burn.
+static void Scene_oil_fire(Grid *grid, Rng *rng) {
+    int w = grid->width, h = grid->height;
+    Scene_fill(grid, 0, h / 2, w - 1, h - 1, CELL_TYPE_OIL);
+    Scene_scatter(grid, rng, 0, h / 2 - 1, w - 1, h / 2 - 1, CELL_TYPE_FIRE, 8);
+    Scene_scatter(grid, rng, 0, h / 4, w - 1, h / 2 - 2, CELL_TYPE_SEED, 64);
+}
+
+// Seeds raining onto a shallow lake, growing into life.
+static void Scene_seed_forest(Grid *grid, Rng *rng) {
+    int w = grid->width, h = grid->height;
+    Scene_fill(grid, 0, h - h / 8, w - 1, h - 1, CELL_TYPE_WATER);
+    Scene_scatter(grid, rng, 0, 0, w - 1, h / 2, CELL_TYPE_SEED, 16);
+}
+
+// A handful of sand grains in a large empty world: mostly measures the cost of sleeping chunks.
+static void Scene_mostly_empty(Grid *grid, Rng *rng) {
+    Scene_scatter(grid, rng, 0, 0, grid->width - 1, grid->height / 2, CELL_TYPE_SAND, 4096);
+}
+
+const Scene scenes[] = {
+    { "sand_avalanche", Scene_sand_avalanche },
+    { "flood",          Scene_flood },
+    { "oil_fire",       Scene_oil_fire },
+    { "seed_forest",    Scene_seed_forest },
+    { "mostly_empty",   Scene_mostly_empty },
+};
+static_assert(NOB_ARRAY_LEN(scenes) == SCENES_COUNT, "SCENES_COUNT is out of date");
+
+const Scene *Scene_find(const char *name) {
+    for (size_t i = 0; i < SCENES_COUNT; ++i) {
+        if (strcmp(scenes[i].name, name) == 0) return &scenes[i];
+    }
+    return NULL;
+}
+
+#endif // SCENES_IMPLEMENTATION
+
+#endif // SCENES_H_
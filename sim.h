@@ -0,0 +1,1750 @@
+#ifndef SIM_H_
+#define SIM_H_
+// Falling sand simulation, independent of any rendering. Define SIM_IMPLEMENTATION
+// in exactly one translation unit before including this file.
+#include <limits.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+#ifndef NOB_H_
+#include "nob.h"
+#endif
+#include "trace.h"
+#include "perf.h"
+
+#ifndef unwrap_null
+#define unwrap_null(x) NOB_ASSERT(x && "unwrap null pointer")
+#endif
+
+// Simulation limits
+#define GRID_SIZE_MAX 16384
+// Paged grids only keep the chunks in use in memory, see Grid_init_paged.
+#define GRID_PAGED_SIZE_MAX 524288
+#define THREADS_MAX 256
+
+typedef enum {
+    CELL_TYPE_NONE,
+    CELL_TYPE_SAND,
+    CELL_TYPE_WATER,
+    CELL_TYPE_OIL,
+    CELL_TYPE_LIFE,
+    CELL_TYPE_SEED,
+    CELL_TYPE_FIRE,
+    CELL_TYPE_ROCK,
+    CELL_TYPE_BEDROCK,
+} Cell_Type;
+
+// Cell types that have an update function. They are contiguous in Cell_Type, so each
+// one owns the active set at index `type - ACTIVE_TYPE_FIRST`.
+#define ACTIVE_TYPE_FIRST CELL_TYPE_SAND
+#define ACTIVE_TYPE_COUNT (CELL_TYPE_FIRE - CELL_TYPE_SAND + 1)
+
+static inline bool Cell_Type_is_active(uint8_t type) {
+    return (unsigned)(type - ACTIVE_TYPE_FIRST) < ACTIVE_TYPE_COUNT;
+}
+
+typedef struct {
+    uint8_t r, g, b;
+} Rgb;
+
+// Display color of every cell type, shared by the window and the frame exporter.
+extern const Rgb Cell_Type_color_table[CELL_TYPE_BEDROCK + 1];
+extern const char *const Cell_Type_name_table[CELL_TYPE_BEDROCK + 1];
+
+// Small seedable generator (xorshift64*) with a buffer of random bits, so a coin flip
+// costs a shift instead of a call. Every chunk owns one, which keeps runs reproducible
+// for a given seed no matter how chunks are spread over threads.
+typedef struct {
+    uint64_t state;
+    uint64_t bits;  // unused random bits, consumed from the low end
+    int bits_left;
+} Rng;
+
+static inline uint64_t splitmix64(uint64_t x) {
+    x += 0x9E3779B97F4A7C15ull;
+    x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ull;
+    x = (x ^ (x >> 27)) * 0x94D049BB133111EBull;
+    return x ^ (x >> 31);
+}
+
+static inline void Rng_seed(Rng *rng, uint64_t seed) {
+    rng->state = splitmix64(seed);
+    if (rng->state == 0) rng->state = 1; // xorshift never leaves 0
+    rng->bits = 0;
+    rng->bits_left = 0;
+}
+
+// 64 fresh random bits.
+static inline uint64_t Rng_next(Rng *rng) {
+    rng->state ^= rng->state >> 12;
+    rng->state ^= rng->state << 25;
+    rng->state ^= rng->state >> 27;
+    return rng->state * 0x2545F4914F6CDD1Dull;
+}
+
+static inline bool Rng_bit(Rng *rng) {
+    if (rng->bits_left == 0) {
+        rng->bits = Rng_next(rng);
+        rng->bits_left = 64;
+    }
+    bool bit = rng->bits & 1;
+    rng->bits >>= 1;
+    rng->bits_left--;
+    return bit;
+}
+
+// Uniform in [0, n), without a modulo.
+static inline uint32_t Rng_range(Rng *rng, uint32_t n) {
+    return ((Rng_next(rng) >> 32) * n) >> 32;
+}
+
+// Inclusive cell rectangle in grid coordinates, empty when min_x > max_x.
+typedef struct {
+    int min_x, min_y, max_x, max_y;
+} Dirty_Rect;
+
+#define DIRTY_RECT_EMPTY ((Dirty_Rect) { .min_x = INT_MAX, .min_y = INT_MAX, .max_x = INT_MIN, .max_y = INT_MIN })
+
+static inline bool Dirty_Rect_is_empty(Dirty_Rect rect) {
+    return rect.min_x > rect.max_x;
+}
+
+// Same as Dirty_Rect, but grown concurrently by the workers simulating neighbouring chunks.
+// Every field only grows and all zeros is the empty rect, so zeroed chunks are asleep: the
+// minimums are kept as INT_MAX - min and the maximums as max + 1.
+typedef struct {
+    atomic_int min_x, min_y, max_x, max_y;
+} Shared_Dirty_Rect;
+
+static inline void atomic_max_int(atomic_int *dst, int value) {
+    int curr = atomic_load_explicit(dst, memory_order_relaxed);
+    while (value > curr && !atomic_compare_exchange_weak_explicit(dst, &curr, value, memory_order_relaxed, memory_order_relaxed));
+}
+
+// Only for coordinates inside the grid.
+static inline void Shared_Dirty_Rect_include(Shared_Dirty_Rect *rect, int min_x, int min_y, int max_x, int max_y) {
+    atomic_max_int(&rect->min_x, INT_MAX - min_x);
+    atomic_max_int(&rect->min_y, INT_MAX - min_y);
+    atomic_max_int(&rect->max_x, max_x + 1);
+    atomic_max_int(&rect->max_y, max_y + 1);
+}
+
+// Returns the accumulated rect and resets it to empty. Only called between ticks.
+static inline Dirty_Rect Shared_Dirty_Rect_take(Shared_Dirty_Rect *rect) {
+    Dirty_Rect result = {
+        .min_x = INT_MAX - atomic_exchange_explicit(&rect->min_x, 0, memory_order_relaxed),
+        .min_y = INT_MAX - atomic_exchange_explicit(&rect->min_y, 0, memory_order_relaxed),
+        .max_x = atomic_exchange_explicit(&rect->max_x, 0, memory_order_relaxed) - 1,
+        .max_y = atomic_exchange_explicit(&rect->max_y, 0, memory_order_relaxed) - 1,
+    };
+    return result;
+}
+
+// The grid is split into CHUNK_SIZE x CHUNK_SIZE chunks. A tick only visits the cells
+// inside each chunk's `curr` rect; every change made during the tick grows the `next`
+// rect of the chunks around it. A chunk whose `next` rect stays empty is asleep.
+#define CHUNK_SIZE 64
+// How far a change reaches: a cell writes its direct neighbours, and life looks for
+// water around those neighbours, so a changed cell can unblock cells three away.
+#define DIRTY_MARGIN 3
+// Chunks are simulated in four checkerboard phases. Chunks of the same phase are a whole
+// chunk apart, so a cell reaching DIRTY_MARGIN cells out never meets a cell of another
+// worker, and each phase can run its chunks in parallel.
+#define CHUNK_PHASES 4
+static_assert(CHUNK_SIZE > DIRTY_MARGIN, "same-phase chunks must not reach into each other");
+
+static_assert(CHUNK_SIZE == 64, "a chunk row is one word of an active set");
+
+// A zeroed chunk is a valid sleeping one, which is what lets a paged grid keep its chunks
+// in the file along with the planes, see Grid_init_paged.
+typedef struct {
+    Dirty_Rect curr;        // cells to visit this tick
+    Shared_Dirty_Rect next; // cells to visit next tick
+    Rng rng;                // used by the cells of this chunk, seeded by Grid_prepare_chunk
+    uint32_t epoch_cycle;   // Grid::epoch_cycle in which its epochs were last cleared
+    atomic_bool queued;     // in Grid::woken already
+    atomic_bool listed;     // in Grid::changed already
+    bool prepared;          // see Grid_prepare_chunk
+    // Active sets: for each active type, one word per chunk row with bit i set when
+    // column i of that row holds the type. Kept in sync by Grid_set_type.
+    _Atomic uint64_t active[ACTIVE_TYPE_COUNT][CHUNK_SIZE];
+} Chunk;
+
+typedef struct Grid Grid;
+
+// Where the cells of chunks filled on first use come from, see Grid_load_chunk.
+typedef struct {
+    bool (*load)(void *data, Grid *grid, int chunk); // fills the empty chunk, without waking it
+    uint8_t (*texel)(void *data, int chunk);         // of the chunk at CHUNK_LEVEL, without filling it
+    void (*free)(void *data);
+    void *data;
+} Grid_Loader;
+
+// Struct-of-arrays grid: one byte per cell per plane, row-major.
+// The width x height cells are surrounded by a permanent bedrock halo one cell wide,
+// so every neighbour of a cell is a valid position. Use Grid_index to find a cell.
+struct Grid {
+    int width, height;
+    size_t stride;    // distance in cells between vertically adjacent cells, width + 2
+    uint8_t *types;   // Cell_Type of each cell
+    uint8_t *epochs;  // tick epoch in which each cell was last processed or written
+    uint8_t epoch;    // epoch of the current tick, never 0
+    uint32_t epoch_cycle; // times the epoch wrapped
+    size_t count;     // cells in every plane, halo included
+    void *mapping;    // file mapping holding the planes and chunks of a paged grid, NULL when they are on the heap
+    size_t mapping_size;
+    size_t chunks_offset; // of the chunks in the mapping
+
+    uint64_t row_magic; // see Grid_locate
+    uint64_t version;   // stamped on the chunks that change, bumped by every Snapshot_Buffer_publish and journal record
+    uint64_t seed;
+    int chunks_x, chunks_y;
+    Chunk *chunks;
+    // Grid::version of the last wake of every chunk, the last time its cells may have
+    // changed. Kept apart from the chunks, so finding the ones that changed reads 8 bytes
+    // per chunk rather than faulting in every chunk of a paged grid.
+    _Atomic uint64_t *changed_at;
+    int *woken;                          // chunks woken since the tick started, in no particular order
+    atomic_size_t woken_count;
+    int *changed;                        // chunks woken since the last Snapshot_Buffer_publish, NULL when nobody asks
+    atomic_size_t changed_count;
+    int *awake_chunks;                   // indices of the chunks to visit this tick, grouped by phase
+    size_t phase_begin[CHUNK_PHASES + 1]; // awake_chunks[phase_begin[p]..phase_begin[p+1]] belong to phase p
+    Grid_Loader loader;
+    bool *unloaded;                      // chunks the loader has yet to fill, NULL without a loader
+#ifdef SIM_COUNTERS
+    uint64_t population[CELL_TYPE_BEDROCK + 1]; // interior cells of each type, the halo is not counted
+#endif
+};
+static_assert(CELL_TYPE_BEDROCK <= UINT8_MAX, "Cell_Type does not fit the type plane");
+
+static inline size_t Grid_index(const Grid *grid, int col, int row) {
+    return (size_t)(col + 1) + (size_t)(row + 1) * grid->stride;
+}
+
+// Marks the given cell rectangle to be visited on the next tick, waking up every chunk it overlaps.
+// Every change to the type plane is followed by a wake around it, so woken chunks are also
+// stamped as changed at the current version.
+void Grid_wake(Grid *grid, int min_x, int min_y, int max_x, int max_y);
+
+static inline void Grid_mark_dirty(Grid *grid, int col, int row) {
+    Grid_wake(grid, col - DIRTY_MARGIN, row - DIRTY_MARGIN, col + DIRTY_MARGIN, row + DIRTY_MARGIN);
+}
+
+// Where a cell lives in the active sets.
+typedef struct {
+    size_t chunk; // index into grid->chunks
+    int row;      // row inside the chunk
+    uint64_t bit; // column inside the chunk, as a mask
+} Chunk_Cell;
+
+// Row of a position is pos / stride, computed as the high word of a multiply by a
+// precomputed reciprocal. It is exact as long as count * stride < 2^64.
+static_assert((unsigned __int128)(GRID_PAGED_SIZE_MAX + 2) * (GRID_PAGED_SIZE_MAX + 2) * (GRID_PAGED_SIZE_MAX + 2) <
+              ((unsigned __int128)1 << 64), "Grid_locate cannot divide positions of GRID_PAGED_SIZE_MAX");
+
+static inline Chunk_Cell Grid_locate(const Grid *grid, size_t pos) {
+    size_t row = (size_t)(((unsigned __int128)pos * grid->row_magic) >> 64) - 1;
+    size_t col = pos - (row + 1) * grid->stride - 1;
+    return (Chunk_Cell) {
+        .chunk = col / CHUNK_SIZE + row / CHUNK_SIZE * grid->chunks_x,
+        .row = row % CHUNK_SIZE,
+        .bit = (uint64_t)1 << (col % CHUNK_SIZE),
+    };
+}
+
+static inline void Active_set(_Atomic uint64_t *word, uint64_t bit, bool owned) {
+    if (owned) atomic_store_explicit(word, atomic_load_explicit(word, memory_order_relaxed) | bit, memory_order_relaxed);
+    else atomic_fetch_or_explicit(word, bit, memory_order_relaxed);
+}
+
+static inline void Active_clear(_Atomic uint64_t *word, uint64_t bit, bool owned) {
+    if (owned) atomic_store_explicit(word, atomic_load_explicit(word, memory_order_relaxed) & ~bit, memory_order_relaxed);
+    else atomic_fetch_and_explicit(word, ~bit, memory_order_relaxed);
+}
+
+// Passed as `owned_chunk` when nothing else runs, outside of a tick.
+#define GRID_ALL_CHUNKS SIZE_MAX
+
+// Writes the type of an interior cell, moving it between active sets. During a tick the
+// words of a chunk other than `owned_chunk` can be written by the worker on its other
+// side at the same time, so those are updated atomically.
+static inline void Grid_set_type_owned(Grid *grid, size_t pos, Cell_Type type, size_t owned_chunk) {
+    uint8_t old_type = grid->types[pos];
+    if (old_type == type) return;
+    grid->types[pos] = type;
+    if (!Cell_Type_is_active(old_type) && !Cell_Type_is_active(type)) return;
+
+    Chunk_Cell cell = Grid_locate(grid, pos);
+    Chunk *chunk = &grid->chunks[cell.chunk];
+    bool owned = owned_chunk == GRID_ALL_CHUNKS || owned_chunk == cell.chunk;
+    if (Cell_Type_is_active(old_type)) Active_clear(&chunk->active[old_type - ACTIVE_TYPE_FIRST][cell.row], cell.bit, owned);
+    if (Cell_Type_is_active(type)) Active_set(&chunk->active[type - ACTIVE_TYPE_FIRST][cell.row], cell.bit, owned);
+}
+
+static inline void Grid_set_type(Grid *grid, size_t pos, Cell_Type type) {
+#ifdef SIM_COUNTERS
+    grid->population[grid->types[pos]]--;
+    grid->population[type]++;
+#endif
+    Grid_set_type_owned(grid, pos, type, GRID_ALL_CHUNKS);
+}
+
+// Writes `count` cells of `type` from (col, row) rightwards, outside of a tick. The cells
+// must all be CELL_TYPE_NONE and inside one chunk row, so the active set is filled a word
+// at a time. Loads worlds without a Grid_set_type per cell.
+static inline void Grid_fill_empty_run(Grid *grid, int col, int row, int count, Cell_Type type) {
+    NOB_ASSERT(count > 0 && col % CHUNK_SIZE + count <= CHUNK_SIZE && "Grid_fill_empty_run");
+    if (type == CELL_TYPE_NONE) return;
+    memset(&grid->types[Grid_index(grid, col, row)], type, count);
+#ifdef SIM_COUNTERS
+    grid->population[CELL_TYPE_NONE] -= count;
+    grid->population[type] += count;
+#endif
+    if (!Cell_Type_is_active(type)) return;
+    Chunk *chunk = &grid->chunks[col / CHUNK_SIZE + row / CHUNK_SIZE * grid->chunks_x];
+    uint64_t bits = (count == CHUNK_SIZE ? ~(uint64_t)0 : ((uint64_t)1 << count) - 1) << (col % CHUNK_SIZE);
+    Active_set(&chunk->active[type - ACTIVE_TYPE_FIRST][row % CHUNK_SIZE], bits, true);
+}
+
+// Same for `count` cells of any types, for rows too mixed to be worth splitting into runs.
+static inline void Grid_fill_empty_row(Grid *grid, int col, int row, const uint8_t *types, int count) {
+    NOB_ASSERT(count > 0 && col % CHUNK_SIZE + count <= CHUNK_SIZE && "Grid_fill_empty_row");
+    memcpy(&grid->types[Grid_index(grid, col, row)], types, count);
+    uint64_t words[ACTIVE_TYPE_COUNT + 1] = {0}; // the last one collects the inert types
+#ifdef SIM_COUNTERS
+    int64_t population[CELL_TYPE_BEDROCK + 1] = {0};
+#endif
+    for (int i = 0; i < count; ++i) {
+        uint8_t type = types[i];
+        words[Cell_Type_is_active(type) ? type - ACTIVE_TYPE_FIRST : ACTIVE_TYPE_COUNT] |= (uint64_t)1 << i;
+#ifdef SIM_COUNTERS
+        population[type]++;
+#endif
+    }
+#ifdef SIM_COUNTERS
+    for (size_t type = 0; type < NOB_ARRAY_LEN(population); ++type) grid->population[type] += population[type];
+    grid->population[CELL_TYPE_NONE] -= count;
+#endif
+    Chunk *chunk = &grid->chunks[col / CHUNK_SIZE + row / CHUNK_SIZE * grid->chunks_x];
+    for (size_t i = 0; i < ACTIVE_TYPE_COUNT; ++i) {
+        if (words[i]) Active_set(&chunk->active[i][row % CHUNK_SIZE], words[i] << (col % CHUNK_SIZE), true);
+    }
+}
+
+// Empties every cell of a chunk outside of a tick, so it can be filled again.
+static inline void Grid_clear_chunk(Grid *grid, int chunk_index) {
+    int min_x = chunk_index % grid->chunks_x * CHUNK_SIZE, min_y = chunk_index / grid->chunks_x * CHUNK_SIZE;
+    int width = grid->width - min_x < CHUNK_SIZE ? grid->width - min_x : CHUNK_SIZE;
+    int max_y = grid->height - min_y < CHUNK_SIZE ? grid->height : min_y + CHUNK_SIZE;
+    for (int row = min_y; row < max_y; ++row) {
+        uint8_t *types = &grid->types[Grid_index(grid, min_x, row)];
+#ifdef SIM_COUNTERS
+        for (int i = 0; i < width; ++i) grid->population[types[i]]--;
+        grid->population[CELL_TYPE_NONE] += width;
+#endif
+        memset(types, CELL_TYPE_NONE, width);
+    }
+    memset(grid->chunks[chunk_index].active, 0, sizeof(grid->chunks[chunk_index].active));
+}
+
+// Creates an empty grid, surrounded by bedrock and asleep: whatever fills it wakes the
+// cells it filled, Grid_wake of the whole grid will do.
+void Grid_init(Grid *grid, int width, int height, uint64_t seed);
+// Same, with the type and epoch planes and the chunks in a file at `path` instead of on
+// the heap, up to GRID_PAGED_SIZE_MAX cells a side. Nothing is written until a chunk is
+// first used, so the kernel only ever holds the chunks in use and the pages around them,
+// writes out the ones that stay asleep and reads them back on the next touch, see
+// pager.h. What stays in memory for every chunk is its Grid::changed_at and the indices
+// of the tick, 16 bytes or 1/256 of a byte per cell. The file is removed right away and
+// only lives as long as the grid, it belongs on a disk rather than a tmpfs. Returns false
+// when it cannot be made.
+bool Grid_init_paged(Grid *grid, int width, int height, uint64_t seed, const char *path);
+void Grid_free(Grid *grid);
+// Seeds the generator of a chunk and lays the halo along it the first time, and clears
+// its epochs when they are from an older epoch cycle. Runs on the chunks of a tick and
+// their neighbours, before their cells are read.
+void Grid_prepare_chunk(Grid *grid, int cx, int cy);
+// Hands the grid a loader for the chunks marked in Grid::unloaded, which starts all false.
+// The grid frees the loader with itself.
+void Grid_set_loader(Grid *grid, Grid_Loader loader);
+void Grid_load_chunk_now(Grid *grid, int chunk);
+// Fills a chunk from the loader if it has not been yet. Whatever reads or writes the cells
+// of a chunk outside of a tick loads it first, ticks load the chunks they prepare.
+static inline void Grid_load_chunk(Grid *grid, int chunk) {
+    if (grid->unloaded && grid->unloaded[chunk]) Grid_load_chunk_now(grid, chunk);
+}
+// Loads every chunk that is not yet, then lets go of the loader.
+void Grid_load_all(Grid *grid);
+// Writes the texels of chunk (cx, cy) at `level`, at most CHUNK_LEVEL, to `out`, rows
+// `stride` bytes apart. The chunk must be loaded.
+void Grid_chunk_texels(const Grid *grid, int cx, int cy, int level, uint8_t *out, size_t stride);
+
+// Work-stealing deque of chunk indices (Chase-Lev). The owner takes from the bottom,
+// other workers steal from the top. A phase only fills the deques before the workers
+// start, so the buffer never has to grow.
+#define DEQUE_EMPTY (-1)
+#define DEQUE_ABORT (-2)
+
+typedef struct {
+    atomic_long top, bottom;
+    atomic_int *items;
+    size_t capacity;
+} Deque;
+
+static inline uint64_t time_now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+// What the cell rules did during a tick, counted by every worker without sharing
+// anything and summed at the end of the tick. Only compiled in with SIM_COUNTERS.
+typedef struct {
+    uint64_t updates;      // update function calls
+    uint64_t moves;        // TryMoveCell into the allowed type
+    uint64_t failed_moves; // TryMoveCell into anything else
+    uint64_t swaps;        // SwapCell, including the ones that spread fire
+    uint64_t ignitions;    // flammable cells set on fire
+    uint64_t growths;      // seeds sprouting and life spreading into water
+    uint64_t rng_draws;    // coin flips and ranges drawn from the chunk generators
+    int64_t population[CELL_TYPE_BEDROCK + 1]; // change in the number of cells of each type
+} Sim_Counters;
+
+// Share of the TryMoveCell attempts that found their target taken.
+static inline double Sim_Counters_failed_ratio(const Sim_Counters *counters) {
+    uint64_t attempts = counters->moves + counters->failed_moves;
+    return attempts ? (double)counters->failed_moves / attempts : 0.0;
+}
+
+// Pool of simulation threads that pull chunks from per-worker deques and steal from
+// each other when they run dry. The calling thread acts as worker 0, so a pool of one
+// worker spawns no threads at all.
+typedef struct Worker_Pool Worker_Pool;
+
+typedef struct {
+    Worker_Pool *pool;
+    size_t index;
+    pthread_t thread;
+    Deque deque;
+    uint32_t victim_seed;
+
+    // Counted over the current tick.
+    uint64_t busy_ns;
+    size_t chunks;
+    size_t steals;
+#ifdef SIM_COUNTERS
+    Sim_Counters counters;
+#endif
+#ifdef PROFILE
+    uint64_t pass_ns[ACTIVE_TYPE_COUNT]; // of the sampled chunks
+    size_t sample_counter;               // chunks ever updated, not reset between ticks
+#endif
+#ifdef PERF
+    Perf_Counts perf_sweep;                   // of every phase, from the first chunk to the last
+    Perf_Counts perf_pass[ACTIVE_TYPE_COUNT]; // of the sampled chunks
+    size_t perf_sample_counter;
+#endif
+} Worker;
+
+// How the last tick was spread over the workers.
+typedef struct {
+    double time_ms;  // wall time of the whole tick
+    double balance;  // busy time / (workers * slowest worker time) summed over phases, 1.0 is perfect
+    size_t chunks;   // chunks simulated
+    size_t steals;   // chunks that ran on a worker other than the one they were queued on
+#ifdef PROFILE
+    double pass_ms[ACTIVE_TYPE_COUNT]; // time in each element's pass, summed over the workers
+#endif
+#ifdef SIM_COUNTERS
+    Sim_Counters counters; // summed over the workers
+#endif
+#ifdef PERF
+    Perf_Counts perf_sweep;                   // hardware counters of the workers while they ran the phases
+    Perf_Counts perf_pass[ACTIVE_TYPE_COUNT]; // of each element's pass, extrapolated from the sampled chunks
+#endif
+} Tick_Stats;
+
+#ifdef PROFILE
+// Element passes are timed on one chunk out of this many per worker, and scaled up, which
+// keeps the clock reads well under 1% of a tick.
+#define PROFILE_CHUNK_SAMPLING 64
+#endif
+
+#ifdef PERF
+// Same for the hardware counters, a read is a syscall.
+#define PERF_CHUNK_SAMPLING 64
+#endif
+
+struct Worker_Pool {
+    Worker *workers;
+    size_t count;
+
+    pthread_mutex_t mutex;
+    pthread_cond_t wake;
+    pthread_cond_t done;
+    size_t generation; // bumped every time a phase is dispatched
+    size_t running;    // workers that have not finished the current phase yet
+    bool quit;
+
+    Grid *grid;        // grid of the phase being run
+    Tick_Stats stats;  // of the last finished tick
+    uint64_t phase_busy_ns, phase_span_ns; // accumulated over the phases of the current tick
+};
+
+// `count` of 0 sizes the pool to the number of online cores.
+void Worker_Pool_init(Worker_Pool *pool, size_t count);
+void Worker_Pool_free(Worker_Pool *pool);
+// Visits the dirty rect of every awake chunk, one checkerboard phase at a time.
+void Grid_tick(Grid *grid, Worker_Pool *pool);
+
+// Mip pyramid of the cell types: level k has one texel per 2^k x 2^k block of the grid,
+// holding the most common type of the 2 x 2 texels below it. A missing odd column or row
+// repeats the last one. Blocks of up to CHUNK_LEVEL levels never straddle two chunks.
+#define CHUNK_LEVEL 6
+#define MIP_LEVELS_MAX 20
+static_assert(CHUNK_SIZE == 1 << CHUNK_LEVEL, "a chunk is one texel of level CHUNK_LEVEL");
+static_assert(GRID_PAGED_SIZE_MAX <= 1 << (MIP_LEVELS_MAX - 1), "the last level is a single texel");
+
+typedef struct {
+    uint8_t *types;
+    int width, height;
+} Mip_Level;
+
+static inline uint8_t Mip_pick(uint8_t a, uint8_t b, uint8_t c, uint8_t d) {
+    if (a == b || a == c || a == d) return a;
+    if (b == c || b == d) return b;
+    if (c == d) return c;
+    // All different: show something rather than nothing.
+    return a != CELL_TYPE_NONE ? a : b != CELL_TYPE_NONE ? b : c != CELL_TYPE_NONE ? c : d;
+}
+
+// Part of the grid a reader looks at, in cells, and the mip level it wants it at.
+typedef struct {
+    int level;
+    int min_x, min_y, max_x, max_y; // inclusive
+} Snapshot_View;
+
+// The texels of a view, for readers outside the simulation. Below CHUNK_LEVEL the view is
+// widened to whole chunks, so a slot can keep the chunks that did not change.
+typedef struct {
+    uint8_t *types;       // (x1 - x0) * (y1 - y0) texels, row-major
+    int level;
+    int x0, y0, x1, y1;   // texels of `level` held, the ends excluded
+    uint64_t version;     // Grid::version when the snapshot was taken, 0 before the first one
+    uint64_t content;     // differs from the previous snapshot's when its texels do
+    int width, height;    // of the grid
+    uint64_t seed;
+    Tick_Stats stats;     // of the last tick before the snapshot
+#ifdef SIM_COUNTERS
+    uint64_t population[CELL_TYPE_BEDROCK + 1]; // Grid::population when the snapshot was taken
+#endif
+} Snapshot;
+
+// Lock-free triple buffer of snapshots between the simulation and a single reader. The
+// simulation fills the back slot and swaps it with the middle one, the reader swaps the
+// middle one with its front slot whenever a newer one is there, so neither ever waits.
+// Nothing in it grows with the grid but the levels from CHUNK_LEVEL up, one byte per
+// chunk and a third more, kept up to date from Grid::changed.
+#define SNAPSHOT_FRESH 4
+
+typedef struct {
+    Snapshot slots[3];
+    int back;          // owned by the simulation
+    atomic_int middle; // slot index, plus SNAPSHOT_FRESH when it was not read yet
+    int front;         // owned by the reader
+
+    // Owned by the simulation.
+    int side;          // texels a slot holds across and down
+    uint8_t *scratch;  // for moving a slot's texels when its view moves
+    Mip_Level chunk_levels[MIP_LEVELS_MAX - CHUNK_LEVEL]; // levels CHUNK_LEVEL and up
+    int chunk_level_count;
+    Snapshot_View view;      // of the previous snapshot
+    uint64_t content;
+} Snapshot_Buffer;
+
+// Snapshots of at most `side` x `side` texels. Starts the Grid::changed list of the grid.
+void Snapshot_Buffer_init(Snapshot_Buffer *buffer, Grid *grid, int side);
+void Snapshot_Buffer_free(Snapshot_Buffer *buffer);
+// Called by the simulation between ticks.
+void Snapshot_Buffer_publish(Snapshot_Buffer *buffer, Grid *grid, const Snapshot_View *view, const Tick_Stats *stats);
+// Returns the newest snapshot if one was published since the last call, NULL otherwise.
+// The returned snapshot stays valid until the next call.
+const Snapshot *Snapshot_Buffer_acquire(Snapshot_Buffer *buffer);
+
+#ifdef SIM_IMPLEMENTATION
+
+#include <fcntl.h>
+#include <sys/mman.h>
+
+const Rgb Cell_Type_color_table[] = {
+    [CELL_TYPE_BEDROCK] = { 130, 130, 130 },
+    [CELL_TYPE_ROCK] = { 130, 130, 130 },
+    [CELL_TYPE_WATER] = { 0, 121, 241 },
+    [CELL_TYPE_LIFE] = { 0, 228, 48 },
+    [CELL_TYPE_SEED] = { 0, 117, 44 },
+    [CELL_TYPE_SAND] = { 211, 176, 131 },
+    [CELL_TYPE_FIRE] = { 255, 161, 0 },
+    [CELL_TYPE_NONE] = { 80, 80, 80 },
+    [CELL_TYPE_OIL] = { 127, 106, 79 },
+};
+static_assert(NOB_ARRAY_LEN(Cell_Type_color_table) == 9, "Cell_Type has change");
+
+const char *const Cell_Type_name_table[] = {
+    [CELL_TYPE_NONE] = "none",
+    [CELL_TYPE_SAND] = "sand",
+    [CELL_TYPE_WATER] = "water",
+    [CELL_TYPE_OIL] = "oil",
+    [CELL_TYPE_LIFE] = "life",
+    [CELL_TYPE_SEED] = "seed",
+    [CELL_TYPE_FIRE] = "fire",
+    [CELL_TYPE_ROCK] = "rock",
+    [CELL_TYPE_BEDROCK] = "bedrock",
+};
+static_assert(NOB_ARRAY_LEN(Cell_Type_name_table) == 9, "Cell_Type has change");
+
+static_assert(CELL_TYPE_NONE  == 0, "Cell_Type has change");
+static bool Cell_Type_flamable_table[] = {
+    [CELL_TYPE_LIFE] = true,
+    [CELL_TYPE_SEED] = true,
+    [CELL_TYPE_OIL] = true,
+    [CELL_TYPE_WATER] = false,
+    [CELL_TYPE_BEDROCK] = false,
+    [CELL_TYPE_ROCK] = false,
+    [CELL_TYPE_SAND] = false,
+    [CELL_TYPE_FIRE] = false,
+    [CELL_TYPE_NONE] = false,
+};
+static_assert(NOB_ARRAY_LEN(Cell_Type_flamable_table) == 9, "Cell_Type has change");
+
+void Grid_wake(Grid *grid, int min_x, int min_y, int max_x, int max_y) {
+    if (min_x < 0) min_x = 0;
+    if (min_y < 0) min_y = 0;
+    if (max_x > grid->width - 1) max_x = grid->width - 1;
+    if (max_y > grid->height - 1) max_y = grid->height - 1;
+    if (min_x > max_x || min_y > max_y) return;
+
+    for (int cy = min_y / CHUNK_SIZE; cy <= max_y / CHUNK_SIZE; ++cy) {
+        int chunk_min_y = cy * CHUNK_SIZE, chunk_max_y = chunk_min_y + CHUNK_SIZE - 1;
+        for (int cx = min_x / CHUNK_SIZE; cx <= max_x / CHUNK_SIZE; ++cx) {
+            int chunk_min_x = cx * CHUNK_SIZE, chunk_max_x = chunk_min_x + CHUNK_SIZE - 1;
+            int index = cx + cy * grid->chunks_x;
+            Chunk *chunk = &grid->chunks[index];
+            Shared_Dirty_Rect_include(&chunk->next,
+                                      min_x > chunk_min_x ? min_x : chunk_min_x,
+                                      min_y > chunk_min_y ? min_y : chunk_min_y,
+                                      max_x < chunk_max_x ? max_x : chunk_max_x,
+                                      max_y < chunk_max_y ? max_y : chunk_max_y);
+            if (!atomic_load_explicit(&chunk->queued, memory_order_relaxed) &&
+                !atomic_exchange_explicit(&chunk->queued, true, memory_order_relaxed)) {
+                grid->woken[atomic_fetch_add_explicit(&grid->woken_count, 1, memory_order_relaxed)] = index;
+            }
+            if (grid->changed && !atomic_load_explicit(&chunk->listed, memory_order_relaxed) &&
+                !atomic_exchange_explicit(&chunk->listed, true, memory_order_relaxed)) {
+                grid->changed[atomic_fetch_add_explicit(&grid->changed_count, 1, memory_order_relaxed)] = index;
+            }
+            if (atomic_load_explicit(&grid->changed_at[index], memory_order_relaxed) != grid->version) {
+                atomic_store_explicit(&grid->changed_at[index], grid->version, memory_order_relaxed);
+            }
+        }
+    }
+}
+
+// Lays an empty grid over zeroed planes of (width + 2) * (height + 2) cells and zeroed chunks.
+static void Grid_init_planes(Grid *grid, int width, int height, uint64_t seed, uint8_t *types, uint8_t *epochs, Chunk *chunks) {
+    size_t count = (size_t)(width + 2) * (height + 2);
+    grid->width = width;
+    grid->height = height;
+    grid->stride = width + 2;
+    grid->count = count;
+    grid->row_magic = UINT64_MAX / grid->stride + 1;
+    grid->types = types;
+    grid->epochs = epochs;
+    grid->epoch = 1;
+    grid->epoch_cycle = 0;
+    grid->mapping = NULL;
+    grid->mapping_size = 0;
+    grid->chunks_offset = 0;
+
+    grid->chunks_x = (width + CHUNK_SIZE - 1) / CHUNK_SIZE;
+    grid->chunks_y = (height + CHUNK_SIZE - 1) / CHUNK_SIZE;
+    size_t chunk_count = (size_t)grid->chunks_x * grid->chunks_y;
+    grid->chunks = chunks;
+    // Only the entries of the chunks in use are ever touched, and the kernel maps in the
+    // pages of these arrays as they are.
+    grid->changed_at = calloc(chunk_count, sizeof(*grid->changed_at));
+    grid->woken = malloc(chunk_count * sizeof(*grid->woken));
+    grid->awake_chunks = malloc(chunk_count * sizeof(*grid->awake_chunks));
+    unwrap_null(grid->changed_at);
+    unwrap_null(grid->woken);
+    unwrap_null(grid->awake_chunks);
+    atomic_init(&grid->woken_count, 0);
+    grid->changed = NULL;
+    atomic_init(&grid->changed_count, 0);
+    grid->seed = seed;
+    grid->version = 1;
+#ifdef SIM_COUNTERS
+    memset(grid->population, 0, sizeof(grid->population));
+    grid->population[CELL_TYPE_NONE] = (uint64_t)width * height;
+#endif
+    static_assert(CELL_TYPE_NONE == 0, "zeroed planes leave the grid empty");
+}
+
+void Grid_init(Grid *grid, int width, int height, uint64_t seed) {
+    size_t count = (size_t)(width + 2) * (height + 2);
+    uint8_t *types = calloc(count, sizeof(*types));
+    uint8_t *epochs = calloc(count, sizeof(*epochs));
+    Chunk *chunks = calloc((size_t)((width + CHUNK_SIZE - 1) / CHUNK_SIZE) * ((height + CHUNK_SIZE - 1) / CHUNK_SIZE), sizeof(*chunks));
+    unwrap_null(types);
+    unwrap_null(epochs);
+    unwrap_null(chunks);
+    Grid_init_planes(grid, width, height, seed, types, epochs, chunks);
+}
+
+bool Grid_init_paged(Grid *grid, int width, int height, uint64_t seed, const char *path) {
+    size_t count = (size_t)(width + 2) * (height + 2);
+    size_t chunks = (size_t)((width + CHUNK_SIZE - 1) / CHUNK_SIZE) * ((height + CHUNK_SIZE - 1) / CHUNK_SIZE);
+    size_t page = sysconf(_SC_PAGESIZE);
+    // Every part starts on a page of its own.
+    size_t plane = (count + page - 1) / page * page;
+    size_t size = 2 * plane + (chunks * sizeof(Chunk) + page - 1) / page * page;
+    int fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0600);
+    if (fd < 0) {
+        nob_log(NOB_ERROR, "Could not create %s: %s", path, strerror(errno));
+        return false;
+    }
+    unlink(path);
+    // A new file reads as zeros without taking any space until written.
+    void *mapping = MAP_FAILED;
+    if (ftruncate(fd, size) == 0) mapping = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_NORESERVE, fd, 0);
+    int error = errno;
+    close(fd);
+    if (mapping == MAP_FAILED) {
+        nob_log(NOB_ERROR, "Could not map %zu bytes of %s: %s", size, path, strerror(error));
+        return false;
+    }
+    uint8_t *bytes = mapping;
+    Grid_init_planes(grid, width, height, seed, bytes, bytes + plane, (Chunk *)(bytes + 2 * plane));
+    grid->mapping = mapping;
+    grid->mapping_size = size;
+    grid->chunks_offset = 2 * plane;
+    return true;
+}
+
+void Grid_free(Grid *grid) {
+    if (grid->mapping) {
+        munmap(grid->mapping, grid->mapping_size);
+    } else {
+        free(grid->types);
+        free(grid->epochs);
+        free(grid->chunks);
+    }
+    free((void *)grid->changed_at);
+    free(grid->woken);
+    free(grid->changed);
+    free(grid->awake_chunks);
+    free(grid->unloaded);
+    if (grid->loader.free) grid->loader.free(grid->loader.data);
+    *grid = (Grid) {0};
+}
+
+void Grid_prepare_chunk(Grid *grid, int cx, int cy) {
+    Chunk *chunk = &grid->chunks[cx + cy * grid->chunks_x];
+    int min_x = cx * CHUNK_SIZE, min_y = cy * CHUNK_SIZE;
+    int max_x = cx == grid->chunks_x - 1 ? grid->width - 1 : min_x + CHUNK_SIZE - 1;
+    int max_y = cy == grid->chunks_y - 1 ? grid->height - 1 : min_y + CHUNK_SIZE - 1;
+    // The halo cells next to the chunk, corners included, belong to it.
+    int halo_min_x = cx == 0 ? -1 : min_x, halo_max_x = cx == grid->chunks_x - 1 ? grid->width : max_x;
+    int halo_min_y = cy == 0 ? -1 : min_y, halo_max_y = cy == grid->chunks_y - 1 ? grid->height : max_y;
+    if (!chunk->prepared) {
+        Rng_seed(&chunk->rng, grid->seed ^ splitmix64(cx + (size_t)cy * grid->chunks_x));
+        for (int row = halo_min_y; row <= halo_max_y; ++row) {
+            if (row < 0 || row == grid->height) {
+                memset(&grid->types[Grid_index(grid, halo_min_x, row)], CELL_TYPE_BEDROCK, halo_max_x - halo_min_x + 1);
+                continue;
+            }
+            if (cx == 0) grid->types[Grid_index(grid, -1, row)] = CELL_TYPE_BEDROCK;
+            if (cx == grid->chunks_x - 1) grid->types[Grid_index(grid, grid->width, row)] = CELL_TYPE_BEDROCK;
+        }
+        chunk->prepared = true;
+    }
+    Grid_load_chunk(grid, cx + cy * grid->chunks_x);
+    // A cell counts as updated when its stamp matches the current epoch, so starting
+    // a tick is a single increment. When the epoch wraps, stamps of the previous cycle
+    // could match again. Rather than clearing the whole plane, which would touch every
+    // page of a paged grid, a chunk is cleared the first time it is prepared in the new cycle.
+    if (chunk->epoch_cycle != grid->epoch_cycle) {
+        for (int row = halo_min_y; row <= halo_max_y; ++row) {
+            memset(&grid->epochs[Grid_index(grid, halo_min_x, row)], 0, halo_max_x - halo_min_x + 1);
+        }
+        chunk->epoch_cycle = grid->epoch_cycle;
+    }
+}
+
+void Grid_set_loader(Grid *grid, Grid_Loader loader) {
+    NOB_ASSERT(!grid->unloaded && "Grid_set_loader");
+    grid->loader = loader;
+    grid->unloaded = calloc((size_t)grid->chunks_x * grid->chunks_y, sizeof(*grid->unloaded));
+    unwrap_null(grid->unloaded);
+}
+
+void Grid_load_chunk_now(Grid *grid, int chunk) {
+    grid->unloaded[chunk] = false;
+    if (grid->loader.load(grid->loader.data, grid, chunk)) return;
+    // The source went bad after it was opened: better an empty chunk than half of one.
+    nob_log(NOB_ERROR, "Could not load chunk %d, it stays empty", chunk);
+    Grid_clear_chunk(grid, chunk);
+}
+
+void Grid_load_all(Grid *grid) {
+    if (!grid->unloaded) return;
+    for (int i = 0; i < grid->chunks_x * grid->chunks_y; ++i) Grid_load_chunk(grid, i);
+    free(grid->unloaded);
+    grid->unloaded = NULL;
+    if (grid->loader.free) grid->loader.free(grid->loader.data);
+    grid->loader = (Grid_Loader) {0};
+}
+
+static int Grid_compare_index(const void *a, const void *b) {
+    return *(const int *)a - *(const int *)b;
+}
+
+static inline int Grid_chunk_phase(const Grid *grid, int index) {
+    return index / grid->chunks_x % 2 * 2 + index % grid->chunks_x % 2;
+}
+
+// Only the chunks woken since the last tick are looked at, in the order of a scan of
+// every chunk by phase, so a large grid that is mostly asleep costs next to nothing.
+static inline void Grid_begin_tick(Grid *grid) {
+    grid->epoch++;
+    if (grid->epoch == 0) {
+        grid->epoch = 1;
+        grid->epoch_cycle++;
+    }
+
+    size_t woken = atomic_exchange_explicit(&grid->woken_count, 0, memory_order_relaxed);
+    size_t chunks = (size_t)grid->chunks_x * grid->chunks_y;
+    size_t awake_count = 0;
+    if (woken * 16 > chunks) {
+        // Most chunks are awake: a scan is cheaper than a sort.
+        for (int phase = 0; phase < CHUNK_PHASES; ++phase) {
+            grid->phase_begin[phase] = awake_count;
+            for (int cy = phase / 2; cy < grid->chunks_y; cy += 2) {
+                for (int cx = phase % 2; cx < grid->chunks_x; cx += 2) {
+                    int index = cx + cy * grid->chunks_x;
+                    if (atomic_load_explicit(&grid->chunks[index].queued, memory_order_relaxed)) grid->awake_chunks[awake_count++] = index;
+                }
+            }
+        }
+    } else {
+        size_t counts[CHUNK_PHASES] = {0};
+        for (size_t i = 0; i < woken; ++i) counts[Grid_chunk_phase(grid, grid->woken[i])]++;
+        for (int phase = 0; phase < CHUNK_PHASES; ++phase) {
+            grid->phase_begin[phase] = awake_count;
+            awake_count += counts[phase];
+        }
+        size_t cursor[CHUNK_PHASES];
+        memcpy(cursor, grid->phase_begin, sizeof(cursor));
+        for (size_t i = 0; i < woken; ++i) grid->awake_chunks[cursor[Grid_chunk_phase(grid, grid->woken[i])]++] = grid->woken[i];
+        for (int phase = 0; phase < CHUNK_PHASES; ++phase) {
+            qsort(grid->awake_chunks + grid->phase_begin[phase], counts[phase], sizeof(*grid->awake_chunks), Grid_compare_index);
+        }
+    }
+    grid->phase_begin[CHUNK_PHASES] = awake_count;
+    NOB_ASSERT(awake_count == woken && "Grid_begin_tick");
+
+    for (size_t i = 0; i < awake_count; ++i) {
+        Chunk *chunk = &grid->chunks[grid->awake_chunks[i]];
+        chunk->curr = Shared_Dirty_Rect_take(&chunk->next);
+        atomic_store_explicit(&chunk->queued, false, memory_order_relaxed);
+    }
+
+    // Cells reach DIRTY_MARGIN cells into the chunks around them.
+    for (size_t i = 0; i < awake_count; ++i) {
+        int cx = grid->awake_chunks[i] % grid->chunks_x, cy = grid->awake_chunks[i] / grid->chunks_x;
+        for (int y = cy > 0 ? cy - 1 : 0; y <= cy + 1 && y < grid->chunks_y; ++y) {
+            for (int x = cx > 0 ? cx - 1 : 0; x <= cx + 1 && x < grid->chunks_x; ++x) {
+                Grid_prepare_chunk(grid, x, y);
+            }
+        }
+    }
+}
+
+static inline bool Grid_is_updated(Grid *grid, size_t pos) {
+    return grid->epochs[pos] == grid->epoch;
+}
+
+static inline void Grid_mark_updated(Grid *grid, size_t pos) {
+    grid->epochs[pos] = grid->epoch;
+}
+
+// State of one worker while it updates cells, passed to every cell update function.
+typedef struct {
+    Grid *grid;
+    Rng *rng;           // of the chunk being updated
+    size_t chunk_index; // chunk being updated, the only one whose active sets this worker owns
+    bool active;        // set by the cell being updated when it changed something or may still move
+#ifdef SIM_COUNTERS
+    Sim_Counters *counters; // of the worker
+#endif
+#ifdef PROFILE
+    uint64_t *pass_ns;  // of the worker, per active type, NULL when this chunk is not sampled
+    bool timed;         // for the profiler or the trace
+    uint64_t pass_mark; // when the previous pass ended
+#endif
+#ifdef PERF
+    Perf_Counts *perf_pass;  // of the worker, per active type, NULL when this chunk is not sampled
+    Perf_Counts perf_mark;   // when the previous pass ended
+#endif
+} Tick_Ctx;
+
+#ifdef SIM_COUNTERS
+#define SIM_COUNT(ctx, counter) ((ctx)->counters->counter++)
+#else
+#define SIM_COUNT(ctx, counter) ((void)0)
+#endif
+
+static inline void Tick_set_type(Tick_Ctx *ctx, size_t pos, Cell_Type type) {
+#ifdef SIM_COUNTERS
+    ctx->counters->population[ctx->grid->types[pos]]--;
+    ctx->counters->population[type]++;
+#endif
+    Grid_set_type_owned(ctx->grid, pos, type, ctx->chunk_index);
+}
+
+static inline bool Tick_rng_bit(Tick_Ctx *ctx) {
+    SIM_COUNT(ctx, rng_draws);
+    return Rng_bit(ctx->rng);
+}
+
+static inline uint32_t Tick_rng_range(Tick_Ctx *ctx, uint32_t n) {
+    SIM_COUNT(ctx, rng_draws);
+    return Rng_range(ctx->rng, n);
+}
+
+static inline void Tick_mark_written(Tick_Ctx *ctx, size_t pos) {
+    Grid_mark_updated(ctx->grid, pos);
+    ctx->active = true;
+}
+
+// Keeps the current cell's neighbourhood awake when it did not move only because of a coin flip.
+static inline void Tick_keep_awake(Tick_Ctx *ctx) {
+    ctx->active = true;
+}
+
+void UpdateSand(Tick_Ctx *ctx, size_t pos);
+void UpdateWater(Tick_Ctx *ctx, size_t pos);
+void UpdateOil(Tick_Ctx *ctx, size_t pos);
+void UpdateLife(Tick_Ctx *ctx, size_t pos);
+void UpdateSeed(Tick_Ctx *ctx, size_t pos);
+void UpdateFire(Tick_Ctx *ctx, size_t pos);
+bool SwapCell(Tick_Ctx *ctx, size_t src_pos, size_t dst_pos);
+bool TryMoveCell(Tick_Ctx *ctx, size_t src_pos, size_t dst_pos, Cell_Type allowed_type);
+int CountNeighbors(Grid *grid, size_t pos, Cell_Type type);
+bool HasNeighbor(Grid *grid, size_t pos, Cell_Type type);
+bool TryUpdateSeed(Tick_Ctx *ctx, size_t seed_pos, size_t pos);
+
+typedef void (*CellUpdateFn)(Tick_Ctx*, size_t);
+
+// Visits the cells of one type inside the chunk's dirty rect, bottom to top and right to
+// left within a row, so falling cells are visited before the cells above them. The word of
+// a row is read once up front: any cell that changes during the pass is stamped as updated,
+// so a stale bit never hands out a cell of another type.
+static inline __attribute__((always_inline))
+void Grid_update_type(Tick_Ctx *ctx, Cell_Type type, CellUpdateFn update) {
+    Grid *grid = ctx->grid;
+    Chunk *chunk = &grid->chunks[ctx->chunk_index];
+    Dirty_Rect rect = chunk->curr;
+    int chunk_x = ctx->chunk_index % grid->chunks_x * CHUNK_SIZE;
+    int chunk_y = ctx->chunk_index / grid->chunks_x * CHUNK_SIZE;
+    uint64_t columns = (~(uint64_t)0 >> (CHUNK_SIZE - 1 - (rect.max_x - chunk_x))) & (~(uint64_t)0 << (rect.min_x - chunk_x));
+    _Atomic uint64_t *words = chunk->active[type - ACTIVE_TYPE_FIRST];
+
+    for (int row = rect.max_y; row >= rect.min_y; --row) {
+        uint64_t word = atomic_load_explicit(&words[row - chunk_y], memory_order_relaxed) & columns;
+        size_t row_pos = Grid_index(grid, chunk_x, row);
+        while (word) {
+            int bit = CHUNK_SIZE - 1 - __builtin_clzll(word);
+            word ^= (uint64_t)1 << bit;
+            size_t pos = row_pos + bit;
+            if (Grid_is_updated(grid, pos)) continue;
+            ctx->active = false;
+            SIM_COUNT(ctx, updates);
+            update(ctx, pos);
+            if (ctx->active) Grid_mark_dirty(grid, chunk_x + bit, row);
+        }
+    }
+}
+
+// Runs one monomorphic pass per active type, so inert cells are never looked at and
+// each update function is called directly.
+// With PROFILE, the time since the previous pass ended is charged to this one, so a
+// timed chunk costs one clock read per pass. PERF does the same with the counters.
+
+static inline __attribute__((always_inline))
+void Grid_update_pass(Tick_Ctx *ctx, Cell_Type type, CellUpdateFn update) {
+    Grid_update_type(ctx, type, update);
+#ifdef PROFILE
+    if (ctx->timed) {
+        uint64_t now = time_now_ns();
+        if (ctx->pass_ns) ctx->pass_ns[type - ACTIVE_TYPE_FIRST] += now - ctx->pass_mark;
+#ifdef TRACE
+        Trace_span(Cell_Type_name_table[type], ctx->pass_mark, now, ctx->chunk_index);
+#endif
+        ctx->pass_mark = now;
+    }
+#endif
+#ifdef PERF
+    if (ctx->perf_pass) {
+        Perf_Counts now = Perf_read();
+        Perf_Counts_add_span(&ctx->perf_pass[type - ACTIVE_TYPE_FIRST], &ctx->perf_mark, &now);
+        ctx->perf_mark = now;
+    }
+#endif
+}
+
+static void Grid_update_chunk(Tick_Ctx *ctx, int chunk_index) {
+    Grid *grid = ctx->grid;
+    ctx->rng = &grid->chunks[chunk_index].rng;
+    ctx->chunk_index = chunk_index;
+#ifdef PROFILE
+    if (ctx->timed) ctx->pass_mark = time_now_ns();
+#endif
+#ifdef PERF
+    if (ctx->perf_pass) ctx->perf_mark = Perf_read();
+#endif
+    static_assert(ACTIVE_TYPE_COUNT == 6, "Cell_Type has change");
+    Grid_update_pass(ctx, CELL_TYPE_SAND, UpdateSand);
+    Grid_update_pass(ctx, CELL_TYPE_WATER, UpdateWater);
+    Grid_update_pass(ctx, CELL_TYPE_OIL, UpdateOil);
+    Grid_update_pass(ctx, CELL_TYPE_LIFE, UpdateLife);
+    Grid_update_pass(ctx, CELL_TYPE_SEED, UpdateSeed);
+    Grid_update_pass(ctx, CELL_TYPE_FIRE, UpdateFire);
+}
+
+static void Deque_reset(Deque *deque, size_t capacity) {
+    if (capacity > deque->capacity) {
+        free(deque->items);
+        deque->items = malloc(capacity * sizeof(*deque->items));
+        unwrap_null(deque->items);
+        deque->capacity = capacity;
+    }
+    atomic_store_explicit(&deque->top, 0, memory_order_relaxed);
+    atomic_store_explicit(&deque->bottom, 0, memory_order_relaxed);
+}
+
+static void Deque_push(Deque *deque, int item) {
+    long bottom = atomic_load_explicit(&deque->bottom, memory_order_relaxed);
+    NOB_ASSERT((size_t)bottom < deque->capacity && "Deque_push");
+    atomic_store_explicit(&deque->items[bottom], item, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    atomic_store_explicit(&deque->bottom, bottom + 1, memory_order_relaxed);
+}
+
+static int Deque_take(Deque *deque) {
+    long bottom = atomic_load_explicit(&deque->bottom, memory_order_relaxed) - 1;
+    atomic_store_explicit(&deque->bottom, bottom, memory_order_relaxed);
+    atomic_thread_fence(memory_order_seq_cst);
+    long top = atomic_load_explicit(&deque->top, memory_order_relaxed);
+    if (top > bottom) {
+        atomic_store_explicit(&deque->bottom, bottom + 1, memory_order_relaxed);
+        return DEQUE_EMPTY;
+    }
+    int item = atomic_load_explicit(&deque->items[bottom], memory_order_relaxed);
+    if (top == bottom) {
+        // Last item, race the thieves for it.
+        if (!atomic_compare_exchange_strong_explicit(&deque->top, &top, top + 1, memory_order_seq_cst, memory_order_relaxed)) {
+            item = DEQUE_EMPTY;
+        }
+        atomic_store_explicit(&deque->bottom, bottom + 1, memory_order_relaxed);
+    }
+    return item;
+}
+
+static int Deque_steal(Deque *deque) {
+    long top = atomic_load_explicit(&deque->top, memory_order_acquire);
+    atomic_thread_fence(memory_order_seq_cst);
+    long bottom = atomic_load_explicit(&deque->bottom, memory_order_acquire);
+    if (top >= bottom) return DEQUE_EMPTY;
+    int item = atomic_load_explicit(&deque->items[top], memory_order_relaxed);
+    if (!atomic_compare_exchange_strong_explicit(&deque->top, &top, top + 1, memory_order_seq_cst, memory_order_relaxed)) {
+        return DEQUE_ABORT;
+    }
+    return item;
+}
+
+static int Worker_find_chunk(Worker *worker) {
+    int chunk = Deque_take(&worker->deque);
+    if (chunk != DEQUE_EMPTY) return chunk;
+
+    Worker_Pool *pool = worker->pool;
+    bool contended;
+    do {
+        contended = false;
+        worker->victim_seed = worker->victim_seed * 1664525u + 1013904223u;
+        size_t first = (worker->victim_seed >> 16) % pool->count;
+        for (size_t i = 0; i < pool->count; ++i) {
+            Worker *victim = &pool->workers[(first + i) % pool->count];
+            if (victim == worker) continue;
+            chunk = Deque_steal(&victim->deque);
+            if (chunk == DEQUE_ABORT) {
+                contended = true;
+            } else if (chunk != DEQUE_EMPTY) {
+                worker->steals++;
+                return chunk;
+            }
+        }
+    } while (contended);
+    // Chunks are only queued before a phase starts, so once every deque is empty the phase is done.
+    return DEQUE_EMPTY;
+}
+
+// Picks one chunk in `period`, a power of two, along a golden ratio sequence. Taking every
+// period-th chunk would sample the same chunk every tick whenever a tick updates a
+// multiple of period chunks, and extrapolate from it alone.
+static inline bool Worker_sample_chunk(size_t *counter, size_t period) {
+    uint64_t x = (uint64_t)(*counter)++ * 0x9E3779B97F4A7C15ull;
+    return x < UINT64_MAX / period;
+}
+
+static void Worker_run_phase(Worker *worker) {
+    uint64_t start = time_now_ns();
+    Tick_Ctx ctx = { .grid = worker->pool->grid };
+#ifdef SIM_COUNTERS
+    ctx.counters = &worker->counters;
+#endif
+#ifdef PERF
+    Perf_Counts perf_start = Perf_read();
+#endif
+    for (int chunk; (chunk = Worker_find_chunk(worker)) != DEQUE_EMPTY;) {
+#ifdef PERF
+        ctx.perf_pass = Worker_sample_chunk(&worker->perf_sample_counter, PERF_CHUNK_SAMPLING) ? worker->perf_pass : NULL;
+#endif
+#ifdef PROFILE
+        ctx.pass_ns = Worker_sample_chunk(&worker->sample_counter, PROFILE_CHUNK_SAMPLING) ? worker->pass_ns : NULL;
+        ctx.timed = ctx.pass_ns != NULL;
+#endif
+#ifdef TRACE
+        ctx.timed |= trace_enabled;
+#endif
+        TRACE_SCOPE("chunk", chunk) {
+            Grid_update_chunk(&ctx, chunk);
+        }
+        worker->chunks++;
+    }
+#ifdef PERF
+    Perf_Counts perf_end = Perf_read();
+    Perf_Counts_add_since(&worker->perf_sweep, &perf_start, &perf_end);
+#endif
+    worker->busy_ns += time_now_ns() - start;
+}
+
+static void *Worker_main(void *arg) {
+    Worker *worker = arg;
+    Worker_Pool *pool = worker->pool;
+    size_t generation = 0;
+#ifdef TRACE
+    char name[32];
+    snprintf(name, sizeof(name), "worker %zu", worker->index);
+    Trace_thread(name);
+#endif
+    for (;;) {
+        pthread_mutex_lock(&pool->mutex);
+        while (!pool->quit && pool->generation == generation) pthread_cond_wait(&pool->wake, &pool->mutex);
+        if (pool->quit) {
+            pthread_mutex_unlock(&pool->mutex);
+#ifdef PERF
+            Perf_thread_stop();
+#endif
+            return NULL;
+        }
+        generation = pool->generation;
+        pthread_mutex_unlock(&pool->mutex);
+
+        Worker_run_phase(worker);
+
+        pthread_mutex_lock(&pool->mutex);
+        if (--pool->running == 0) pthread_cond_signal(&pool->done);
+        pthread_mutex_unlock(&pool->mutex);
+    }
+}
+
+void Worker_Pool_init(Worker_Pool *pool, size_t count) {
+    if (count == 0) {
+        long cores = sysconf(_SC_NPROCESSORS_ONLN);
+        count = cores > 0 ? cores : 1;
+    }
+    *pool = (Worker_Pool) { .count = count };
+    pool->workers = calloc(count, sizeof(*pool->workers));
+    unwrap_null(pool->workers);
+    pthread_mutex_init(&pool->mutex, NULL);
+    pthread_cond_init(&pool->wake, NULL);
+    pthread_cond_init(&pool->done, NULL);
+    for (size_t i = 0; i < count; ++i) {
+        pool->workers[i] = (Worker) { .pool = pool, .index = i, .victim_seed = i + 1 };
+        if (i > 0 && pthread_create(&pool->workers[i].thread, NULL, Worker_main, &pool->workers[i]) != 0) {
+            nob_log(NOB_ERROR, "Could not start simulation worker %zu, continuing with %zu", i, i);
+            pool->count = i;
+            break;
+        }
+    }
+}
+
+void Worker_Pool_free(Worker_Pool *pool) {
+    pthread_mutex_lock(&pool->mutex);
+    pool->quit = true;
+    pthread_cond_broadcast(&pool->wake);
+    pthread_mutex_unlock(&pool->mutex);
+    for (size_t i = 1; i < pool->count; ++i) pthread_join(pool->workers[i].thread, NULL);
+    for (size_t i = 0; i < pool->count; ++i) free(pool->workers[i].deque.items);
+    pthread_mutex_destroy(&pool->mutex);
+    pthread_cond_destroy(&pool->wake);
+    pthread_cond_destroy(&pool->done);
+    free(pool->workers);
+    *pool = (Worker_Pool) {0};
+}
+
+// Queues the chunks of one phase round-robin on the workers' deques, runs the phase on
+// every worker and waits for all of them.
+static void Worker_Pool_run_phase(Worker_Pool *pool, Grid *grid, const int *chunks, size_t chunks_count) {
+    if (chunks_count == 0) return;
+    pool->grid = grid;
+
+    size_t workers = pool->count < chunks_count ? pool->count : chunks_count;
+    size_t capacity = (chunks_count + workers - 1) / workers;
+    uint64_t busy_before = 0;
+    for (size_t i = 0; i < pool->count; ++i) {
+        Deque_reset(&pool->workers[i].deque, capacity);
+        busy_before += pool->workers[i].busy_ns;
+    }
+    for (size_t i = 0; i < chunks_count; ++i) Deque_push(&pool->workers[i % workers].deque, chunks[i]);
+
+    uint64_t start = time_now_ns();
+    if (workers == 1) {
+        // Not worth waking anyone up.
+        Worker_run_phase(&pool->workers[0]);
+    } else {
+        pthread_mutex_lock(&pool->mutex);
+        pool->running = pool->count - 1;
+        pool->generation++;
+        pthread_cond_broadcast(&pool->wake);
+        pthread_mutex_unlock(&pool->mutex);
+
+        Worker_run_phase(&pool->workers[0]);
+
+        pthread_mutex_lock(&pool->mutex);
+        while (pool->running > 0) pthread_cond_wait(&pool->done, &pool->mutex);
+        pthread_mutex_unlock(&pool->mutex);
+    }
+
+    uint64_t busy_after = 0;
+    for (size_t i = 0; i < pool->count; ++i) busy_after += pool->workers[i].busy_ns;
+    pool->phase_busy_ns += busy_after - busy_before;
+    pool->phase_span_ns += (time_now_ns() - start) * workers;
+}
+
+void Grid_tick(Grid *grid, Worker_Pool *pool) {
+    uint64_t start = time_now_ns();
+    for (size_t i = 0; i < pool->count; ++i) {
+        Worker *worker = &pool->workers[i];
+        worker->busy_ns = 0;
+        worker->chunks = 0;
+        worker->steals = 0;
+#ifdef SIM_COUNTERS
+        memset(&worker->counters, 0, sizeof(worker->counters));
+#endif
+#ifdef PROFILE
+        memset(worker->pass_ns, 0, sizeof(worker->pass_ns));
+#endif
+#ifdef PERF
+        worker->perf_sweep = (Perf_Counts) {0};
+        memset(worker->perf_pass, 0, sizeof(worker->perf_pass));
+#endif
+    }
+    pool->phase_busy_ns = 0;
+    pool->phase_span_ns = 0;
+
+    Grid_begin_tick(grid);
+    for (int phase = 0; phase < CHUNK_PHASES; ++phase) {
+        size_t begin = grid->phase_begin[phase];
+        size_t end = grid->phase_begin[phase + 1];
+        TRACE_SCOPE("phase", phase) {
+            Worker_Pool_run_phase(pool, grid, &grid->awake_chunks[begin], end - begin);
+        }
+    }
+
+    Tick_Stats stats = {
+        .time_ms = (time_now_ns() - start) / 1e6,
+        .balance = pool->phase_span_ns ? (double)pool->phase_busy_ns / pool->phase_span_ns : 1.0,
+    };
+    for (size_t i = 0; i < pool->count; ++i) {
+        stats.chunks += pool->workers[i].chunks;
+        stats.steals += pool->workers[i].steals;
+#ifdef SIM_COUNTERS
+        const Sim_Counters *counters = &pool->workers[i].counters;
+        stats.counters.updates += counters->updates;
+        stats.counters.moves += counters->moves;
+        stats.counters.failed_moves += counters->failed_moves;
+        stats.counters.swaps += counters->swaps;
+        stats.counters.ignitions += counters->ignitions;
+        stats.counters.growths += counters->growths;
+        stats.counters.rng_draws += counters->rng_draws;
+        for (size_t type = 0; type < NOB_ARRAY_LEN(counters->population); ++type) {
+            stats.counters.population[type] += counters->population[type];
+            grid->population[type] += counters->population[type];
+        }
+#endif
+#ifdef PROFILE
+        for (size_t j = 0; j < ACTIVE_TYPE_COUNT; ++j) {
+            stats.pass_ms[j] += pool->workers[i].pass_ns[j] * PROFILE_CHUNK_SAMPLING / 1e6;
+        }
+#endif
+#ifdef PERF
+        Perf_Counts_add(&stats.perf_sweep, &pool->workers[i].perf_sweep, 1);
+        for (size_t j = 0; j < ACTIVE_TYPE_COUNT; ++j) {
+            Perf_Counts_add(&stats.perf_pass[j], &pool->workers[i].perf_pass[j], PERF_CHUNK_SAMPLING);
+        }
+#endif
+    }
+    pool->stats = stats;
+#ifdef TRACE
+    Trace_span("tick", start, time_now_ns(), TRACE_NO_ID);
+#endif
+}
+
+// The levels are built in place over a copy of the cells, each one reading ahead of what it writes.
+void Grid_chunk_texels(const Grid *grid, int cx, int cy, int level, uint8_t *out, size_t stride) {
+    int min_x = cx * CHUNK_SIZE, min_y = cy * CHUNK_SIZE;
+    int width = grid->width - min_x < CHUNK_SIZE ? grid->width - min_x : CHUNK_SIZE;
+    int height = grid->height - min_y < CHUNK_SIZE ? grid->height - min_y : CHUNK_SIZE;
+    if (level == 0) {
+        for (int row = 0; row < height; ++row) memcpy(out + row * stride, &grid->types[Grid_index(grid, min_x, min_y + row)], width);
+        return;
+    }
+    uint8_t texels[CHUNK_SIZE * CHUNK_SIZE];
+    for (int row = 0; row < height; ++row) memcpy(texels + row * width, &grid->types[Grid_index(grid, min_x, min_y + row)], width);
+    for (int k = 0; k < level; ++k) {
+        int next_width = (width + 1) / 2, next_height = (height + 1) / 2;
+        for (int y = 0; y < next_height; ++y) {
+            const uint8_t *top = texels + 2 * y * width;
+            const uint8_t *bottom = 2 * y + 1 < height ? top + width : top;
+            for (int x = 0; x < next_width; ++x) {
+                int right = 2 * x + 1 < width ? 2 * x + 1 : 2 * x;
+                texels[y * next_width + x] = Mip_pick(top[2 * x], top[right], bottom[2 * x], bottom[right]);
+            }
+        }
+        width = next_width;
+        height = next_height;
+    }
+    for (int row = 0; row < height; ++row) memcpy(out + row * stride, texels + row * width, width);
+}
+
+// Rebuilds the texel of chunk level `k` over (x, y) from the level below it.
+static void Snapshot_Buffer_pick(Snapshot_Buffer *buffer, int k, int x, int y) {
+    const Mip_Level *src = &buffer->chunk_levels[k - 1];
+    const uint8_t *top = &src->types[(size_t)(2 * y) * src->width];
+    const uint8_t *bottom = 2 * y + 1 < src->height ? top + src->width : top;
+    int right = 2 * x + 1 < src->width ? 2 * x + 1 : 2 * x;
+    buffer->chunk_levels[k].types[(size_t)y * buffer->chunk_levels[k].width + x] =
+        Mip_pick(top[2 * x], top[right], bottom[2 * x], bottom[right]);
+}
+
+// Texel of chunk `index` at CHUNK_LEVEL, which the loader knows without filling the chunk.
+static uint8_t Grid_chunk_texel(const Grid *grid, int index) {
+    if (grid->unloaded && grid->unloaded[index]) return grid->loader.texel(grid->loader.data, index);
+    uint8_t texel;
+    Grid_chunk_texels(grid, index % grid->chunks_x, index / grid->chunks_x, CHUNK_LEVEL, &texel, 1);
+    return texel;
+}
+
+// Brings the chunk levels over chunk `index` up to date.
+static void Snapshot_Buffer_update_chunk(Snapshot_Buffer *buffer, const Grid *grid, int index) {
+    int cx = index % grid->chunks_x, cy = index / grid->chunks_x;
+    buffer->chunk_levels[0].types[index] = Grid_chunk_texel(grid, index);
+    for (int k = 1; k < buffer->chunk_level_count; ++k) Snapshot_Buffer_pick(buffer, k, cx >> k, cy >> k);
+}
+
+void Snapshot_Buffer_init(Snapshot_Buffer *buffer, Grid *grid, int side) {
+    *buffer = (Snapshot_Buffer) { .side = side, .back = 0, .front = 2 };
+    for (size_t i = 0; i < NOB_ARRAY_LEN(buffer->slots); ++i) {
+        Snapshot *snapshot = &buffer->slots[i];
+        *snapshot = (Snapshot) {
+            .width = grid->width,
+            .height = grid->height,
+            .seed = grid->seed,
+        };
+        snapshot->types = malloc((size_t)side * side);
+        unwrap_null(snapshot->types);
+    }
+    buffer->scratch = malloc((size_t)side * side);
+    unwrap_null(buffer->scratch);
+    atomic_init(&buffer->middle, 1);
+
+    size_t chunks = (size_t)grid->chunks_x * grid->chunks_y;
+    grid->changed = malloc(chunks * sizeof(*grid->changed));
+    unwrap_null(grid->changed);
+    buffer->chunk_levels[0] = (Mip_Level) { .width = grid->chunks_x, .height = grid->chunks_y };
+    buffer->chunk_level_count = 1;
+    for (;;) {
+        Mip_Level *level = &buffer->chunk_levels[buffer->chunk_level_count - 1];
+        level->types = calloc((size_t)level->width * level->height, 1);
+        unwrap_null(level->types);
+        if (level->width == 1 && level->height == 1) break;
+        buffer->chunk_levels[buffer->chunk_level_count++] = (Mip_Level) {
+            .width = (level->width + 1) / 2,
+            .height = (level->height + 1) / 2,
+        };
+    }
+    // Chunks that were never woken are empty, and so are their texels already, unless
+    // the loader has yet to fill them.
+    for (size_t i = 0; i < chunks; ++i) {
+        if (atomic_load_explicit(&grid->changed_at[i], memory_order_relaxed) == 0 && !(grid->unloaded && grid->unloaded[i])) continue;
+        buffer->chunk_levels[0].types[i] = Grid_chunk_texel(grid, i);
+    }
+    for (int k = 1; k < buffer->chunk_level_count; ++k) {
+        for (int y = 0; y < buffer->chunk_levels[k].height; ++y) {
+            for (int x = 0; x < buffer->chunk_levels[k].width; ++x) Snapshot_Buffer_pick(buffer, k, x, y);
+        }
+    }
+}
+
+void Snapshot_Buffer_free(Snapshot_Buffer *buffer) {
+    for (size_t i = 0; i < NOB_ARRAY_LEN(buffer->slots); ++i) free(buffer->slots[i].types);
+    free(buffer->scratch);
+    for (int k = 0; k < buffer->chunk_level_count; ++k) free(buffer->chunk_levels[k].types);
+    *buffer = (Snapshot_Buffer) {0};
+}
+
+// Texels of `view` a snapshot holds, within `side` across and down.
+static void Snapshot_View_texels(const Snapshot_View *view, const Grid *grid, int side, int *x0, int *y0, int *x1, int *y1) {
+    int k = view->level;
+    if (k < CHUNK_LEVEL) {
+        *x0 = view->min_x / CHUNK_SIZE * CHUNK_SIZE >> k;
+        *y0 = view->min_y / CHUNK_SIZE * CHUNK_SIZE >> k;
+        *x1 = (view->max_x / CHUNK_SIZE + 1) * (CHUNK_SIZE >> k);
+        *y1 = (view->max_y / CHUNK_SIZE + 1) * (CHUNK_SIZE >> k);
+    } else {
+        *x0 = view->min_x >> k;
+        *y0 = view->min_y >> k;
+        *x1 = (view->max_x >> k) + 1;
+        *y1 = (view->max_y >> k) + 1;
+    }
+    int width = ((grid->width - 1) >> k) + 1, height = ((grid->height - 1) >> k) + 1;
+    if (*x1 > width) *x1 = width;
+    if (*y1 > height) *y1 = height;
+    // Chunks below CHUNK_LEVEL are written whole.
+    if (k < CHUNK_LEVEL) side = side / (CHUNK_SIZE >> k) * (CHUNK_SIZE >> k);
+    if (*x1 - *x0 > side) *x1 = *x0 + side;
+    if (*y1 - *y0 > side) *y1 = *y0 + side;
+}
+
+void Snapshot_Buffer_publish(Snapshot_Buffer *buffer, Grid *grid, const Snapshot_View *view, const Tick_Stats *stats) {
+    Snapshot *snapshot = &buffer->slots[buffer->back];
+    Snapshot_View clamped = *view;
+    if (clamped.level >= CHUNK_LEVEL + buffer->chunk_level_count) clamped.level = CHUNK_LEVEL + buffer->chunk_level_count - 1;
+    int k = clamped.level, x0, y0, x1, y1;
+    Snapshot_View_texels(&clamped, grid, buffer->side, &x0, &y0, &x1, &y1);
+
+    // The chunk levels follow every change, the content only the ones in view.
+    bool content = snapshot->version == 0 || memcmp(&clamped, &buffer->view, sizeof(clamped)) != 0;
+    size_t changed = atomic_exchange_explicit(&grid->changed_count, 0, memory_order_relaxed);
+    for (size_t i = 0; i < changed; ++i) {
+        int index = grid->changed[i];
+        atomic_store_explicit(&grid->chunks[index].listed, false, memory_order_relaxed);
+        Snapshot_Buffer_update_chunk(buffer, grid, index);
+        int cx = index % grid->chunks_x, cy = index / grid->chunks_x;
+        content = content || ((cx * CHUNK_SIZE) >> k < x1 && ((cx + 1) * CHUNK_SIZE - 1) >> k >= x0 &&
+                              (cy * CHUNK_SIZE) >> k < y1 && ((cy + 1) * CHUNK_SIZE - 1) >> k >= y0);
+    }
+    buffer->view = clamped;
+    if (content) buffer->content++;
+
+    if (k >= CHUNK_LEVEL) {
+        const Mip_Level *level = &buffer->chunk_levels[k - CHUNK_LEVEL];
+        for (int y = y0; y < y1; ++y) {
+            memcpy(&snapshot->types[(size_t)(y - y0) * (x1 - x0)], &level->types[(size_t)y * level->width + x0], x1 - x0);
+        }
+    } else {
+        // Below CHUNK_LEVEL the slot is a cache: chunks it held at the same level that did
+        // not change since are moved rather than built again.
+        bool reuse = snapshot->version != 0 && snapshot->level == k;
+        int chunk_texels = CHUNK_SIZE >> k;
+        if (reuse && (snapshot->x0 != x0 || snapshot->y0 != y0 || snapshot->x1 != x1 || snapshot->y1 != y1)) {
+            int ox0 = x0 > snapshot->x0 ? x0 : snapshot->x0, ox1 = x1 < snapshot->x1 ? x1 : snapshot->x1;
+            int oy0 = y0 > snapshot->y0 ? y0 : snapshot->y0, oy1 = y1 < snapshot->y1 ? y1 : snapshot->y1;
+            for (int y = oy0; y < oy1 && ox0 < ox1; ++y) {
+                memcpy(&buffer->scratch[(size_t)(y - y0) * (x1 - x0) + (ox0 - x0)],
+                       &snapshot->types[(size_t)(y - snapshot->y0) * (snapshot->x1 - snapshot->x0) + (ox0 - snapshot->x0)], ox1 - ox0);
+            }
+            uint8_t *types = snapshot->types;
+            snapshot->types = buffer->scratch;
+            buffer->scratch = types;
+        }
+        for (int cy = y0 / chunk_texels; cy * chunk_texels < y1; ++cy) {
+            for (int cx = x0 / chunk_texels; cx * chunk_texels < x1; ++cx) {
+                int tx = cx * chunk_texels, ty = cy * chunk_texels;
+                bool held = reuse && tx >= snapshot->x0 && tx < snapshot->x1 && ty >= snapshot->y0 && ty < snapshot->y1 &&
+                            atomic_load_explicit(&grid->changed_at[cx + cy * grid->chunks_x], memory_order_relaxed) <= snapshot->version;
+                if (held) continue;
+                Grid_load_chunk(grid, cx + cy * grid->chunks_x);
+                Grid_chunk_texels(grid, cx, cy, k, &snapshot->types[(size_t)(ty - y0) * (x1 - x0) + (tx - x0)], x1 - x0);
+            }
+        }
+    }
+    snapshot->level = k;
+    snapshot->x0 = x0;
+    snapshot->y0 = y0;
+    snapshot->x1 = x1;
+    snapshot->y1 = y1;
+    snapshot->content = buffer->content;
+    snapshot->version = grid->version;
+    snapshot->stats = *stats;
+#ifdef SIM_COUNTERS
+    memcpy(snapshot->population, grid->population, sizeof(snapshot->population));
+#endif
+    // Changes made from now on must be told apart from the ones in this snapshot.
+    grid->version++;
+
+    int previous = atomic_exchange_explicit(&buffer->middle, buffer->back | SNAPSHOT_FRESH, memory_order_acq_rel);
+    buffer->back = previous & ~SNAPSHOT_FRESH;
+}
+
+const Snapshot *Snapshot_Buffer_acquire(Snapshot_Buffer *buffer) {
+    if (!(atomic_load_explicit(&buffer->middle, memory_order_relaxed) & SNAPSHOT_FRESH)) return NULL;
+    int previous = atomic_exchange_explicit(&buffer->middle, buffer->front, memory_order_acq_rel);
+    buffer->front = previous & ~SNAPSHOT_FRESH;
+    return &buffer->slots[buffer->front];
+}
+
+// The cell update functions below work on raw positions. Every cell they visit is inside
+// the bedrock halo, so each neighbour offset is valid without a bounds check, and the halo
+// itself is never written since no rule moves into or swaps with bedrock.
+
+bool SwapCell(Tick_Ctx *ctx, size_t src_pos, size_t dst_pos) {
+    Grid *grid = ctx->grid;
+    SIM_COUNT(ctx, swaps);
+    Cell_Type tmp = grid->types[src_pos];
+    Tick_set_type(ctx, src_pos, grid->types[dst_pos]);
+    Tick_set_type(ctx, dst_pos, tmp);
+
+    Tick_mark_written(ctx, src_pos);
+    Tick_mark_written(ctx, dst_pos);
+    return true;
+}
+
+bool TryMoveCell(Tick_Ctx *ctx, size_t src_pos, size_t dst_pos, Cell_Type allowed_type) {
+    Grid *grid = ctx->grid;
+    if (grid->types[dst_pos] == allowed_type) {
+        Tick_set_type(ctx, dst_pos, grid->types[src_pos]);
+        Tick_mark_written(ctx, dst_pos);
+        Tick_set_type(ctx, src_pos, CELL_TYPE_NONE);
+        Tick_mark_written(ctx, src_pos);
+        SIM_COUNT(ctx, moves);
+        return true;
+    }
+    SIM_COUNT(ctx, failed_moves);
+    return false;
+}
+
+void UpdateSand(Tick_Ctx *ctx, size_t pos) {
+    Grid *grid = ctx->grid;
+    Grid_mark_updated(grid, pos);
+
+    size_t down = pos + grid->stride;
+    if (TryMoveCell(ctx, pos, down, CELL_TYPE_NONE)) return;
+    int side = Tick_rng_bit(ctx) ? -1 : 1;
+    size_t down_side = down + side;
+    if (TryMoveCell(ctx, pos, down_side, CELL_TYPE_NONE)) return;
+    if (grid->types[down - side] == CELL_TYPE_NONE) Tick_keep_awake(ctx);
+
+    if (grid->types[down] == CELL_TYPE_WATER && SwapCell(ctx, pos, down)) return;
+    if (grid->types[down] == CELL_TYPE_OIL && SwapCell(ctx, pos, down)) return;
+}
+
+void UpdateOil(Tick_Ctx *ctx, size_t pos) {
+    Grid *grid = ctx->grid;
+    Grid_mark_updated(grid, pos);
+    size_t down = pos + grid->stride;
+    size_t top = pos - grid->stride;
+
+    if (TryMoveCell(ctx, pos, down, CELL_TYPE_NONE)) return;
+
+    int dir = Tick_rng_bit(ctx) ? -1 : 1;
+    size_t side = pos + dir;
+    if (TryMoveCell(ctx, pos, side, CELL_TYPE_NONE)) return;
+    if (grid->types[pos - dir] == CELL_TYPE_NONE) Tick_keep_awake(ctx);
+
+    dir = Tick_rng_bit(ctx) ? -1 : 1;
+    size_t down_side = down + dir;
+    if (TryMoveCell(ctx, pos, down_side,  CELL_TYPE_NONE)) return;
+    if (grid->types[down - dir] == CELL_TYPE_NONE) Tick_keep_awake(ctx);
+
+    if (grid->types[top] == CELL_TYPE_WATER && SwapCell(ctx, pos, top)) return;
+    if (grid->types[top] == CELL_TYPE_SAND && SwapCell(ctx, pos, top)) return;
+}
+
+// Fire moves into a flammable neighbour, leaving an empty cell behind.
+static bool TryIgnite(Tick_Ctx *ctx, size_t pos, size_t target) {
+    if (!Cell_Type_flamable_table[ctx->grid->types[target]]) return false;
+    SwapCell(ctx, pos, target);
+    Tick_set_type(ctx, pos, CELL_TYPE_NONE);
+    SIM_COUNT(ctx, ignitions);
+    return true;
+}
+
+void UpdateFire(Tick_Ctx *ctx, size_t pos) {
+    Grid *grid = ctx->grid;
+    Grid_mark_updated(grid, pos);
+    size_t down = pos + grid->stride;
+    size_t top = pos - grid->stride;
+    size_t left = pos - 1;
+    size_t right = pos + 1;
+
+    int dir = Tick_rng_bit(ctx) ? -1 : 1;
+    size_t side = pos + dir;
+
+    dir = Tick_rng_bit(ctx) ? -1 : 1;
+    size_t down_side = down + dir;
+
+    if(TryIgnite(ctx, pos, top)) {
+        return;
+    }
+    if(TryIgnite(ctx, pos, down)) {
+        TryMoveCell(ctx, pos, down, CELL_TYPE_NONE);
+        return;
+    }
+    if(TryIgnite(ctx, pos, left)) {
+        TryMoveCell(ctx, pos, left, CELL_TYPE_NONE);
+        return;
+    }
+    if(TryIgnite(ctx, pos, right)) {
+        TryMoveCell(ctx, pos, right, CELL_TYPE_NONE);
+        return;
+    }
+    if(TryIgnite(ctx, pos, side)) {
+        TryMoveCell(ctx, pos, side, CELL_TYPE_NONE);
+        return;
+    }
+    if(TryIgnite(ctx, pos, down_side)) {
+        TryMoveCell(ctx, pos, down_side,  CELL_TYPE_NONE);
+        return;
+    }
+    if (TryMoveCell(ctx, pos, down, CELL_TYPE_NONE)) return;
+    Tick_set_type(ctx, pos, CELL_TYPE_NONE);
+    Tick_mark_written(ctx, pos);
+}
+
+bool TryUpdateSeed(Tick_Ctx *ctx, size_t seed_pos, size_t pos) {
+    Grid *grid = ctx->grid;
+    if (grid->types[pos] == CELL_TYPE_WATER) {
+        Tick_set_type(ctx, pos, CELL_TYPE_LIFE);
+        Tick_mark_written(ctx, pos);
+        Tick_set_type(ctx, seed_pos, CELL_TYPE_NONE);
+        SIM_COUNT(ctx, growths);
+        return true;
+    }
+    return false;
+}
+
+void UpdateSeed(Tick_Ctx *ctx, size_t pos) {
+    Grid *grid = ctx->grid;
+    Grid_mark_updated(grid, pos);
+
+    size_t down = pos + grid->stride;
+    if (TryUpdateSeed(ctx, pos, down)) return;
+    if (TryMoveCell(ctx, pos, down, CELL_TYPE_NONE)) return;
+
+    int side = Tick_rng_bit(ctx) ? -1 : 1;
+    size_t down_side = down + side;
+    if (TryUpdateSeed(ctx, pos, down_side)) return;
+    if (TryMoveCell(ctx, pos, down_side, CELL_TYPE_NONE)) return;
+    Cell_Type other_side = grid->types[down - side];
+    if (other_side == CELL_TYPE_NONE || other_side == CELL_TYPE_WATER) Tick_keep_awake(ctx);
+    size_t top = pos - grid->stride;
+    if (TryUpdateSeed(ctx, pos, top)) return;
+}
+
+void UpdateWater(Tick_Ctx *ctx, size_t pos) {
+    Grid *grid = ctx->grid;
+    Grid_mark_updated(grid, pos);
+    size_t down = pos + grid->stride;
+    size_t top = pos - grid->stride;
+
+    if (TryMoveCell(ctx, pos, down, CELL_TYPE_NONE)) return;
+
+    int dir = Tick_rng_bit(ctx) ? -1 : 1;
+    size_t side = pos + dir;
+    if (TryMoveCell(ctx, pos, side, CELL_TYPE_NONE)) return;
+    if (grid->types[pos - dir] == CELL_TYPE_NONE) Tick_keep_awake(ctx);
+
+    dir = Tick_rng_bit(ctx) ? -1 : 1;
+    size_t down_side = down + dir;
+    if (TryMoveCell(ctx, pos, down_side,  CELL_TYPE_NONE)) return;
+    if (grid->types[down - dir] == CELL_TYPE_NONE) Tick_keep_awake(ctx);
+
+    if (grid->types[top] == CELL_TYPE_SAND && SwapCell(ctx, pos, top)) return;
+}
+
+// Neighbour queries look one cell out, so they are valid for any cell inside the halo.
+int CountNeighbors(Grid *grid, size_t pos, Cell_Type type) {
+    size_t stride = grid->stride;
+    return (grid->types[pos - stride] == type)
+         + (grid->types[pos - 1] == type)
+         + (grid->types[pos + stride - 1] == type)
+         + (grid->types[pos + stride] == type)
+         + (grid->types[pos + 1] == type)
+         + (grid->types[pos + stride + 1] == type);
+}
+
+bool HasNeighbor(Grid *grid, size_t pos, Cell_Type type) {
+    size_t stride = grid->stride;
+    return grid->types[pos - stride] == type
+        || grid->types[pos + stride] == type
+        || grid->types[pos - 1] == type
+        || grid->types[pos + 1] == type;
+}
+
+void UpdateLife(Tick_Ctx *ctx, size_t pos) {
+    Grid *grid = ctx->grid;
+    Grid_mark_updated(grid, pos);
+
+    size_t candidates[4];
+    int count = 0;
+
+    // Halo cells are bedrock, never CELL_TYPE_NONE, so HasNeighbor only runs on interior cells.
+    size_t top = pos - grid->stride;
+    if (grid->types[top] == CELL_TYPE_NONE && HasNeighbor(grid, top, CELL_TYPE_WATER)) {
+        candidates[count++] = top;
+    }
+    size_t down = pos + grid->stride;
+    if (grid->types[down] == CELL_TYPE_NONE && HasNeighbor(grid, down, CELL_TYPE_WATER)) {
+        Tick_set_type(ctx, down, CELL_TYPE_LIFE);
+        Tick_mark_written(ctx, down);
+        SIM_COUNT(ctx, growths);
+        return;
+    }
+    size_t left = pos - 1;
+    if (grid->types[left] == CELL_TYPE_NONE && HasNeighbor(grid, left, CELL_TYPE_WATER)) {
+        candidates[count++] = left;
+    }
+    size_t right = pos + 1;
+    if (grid->types[right] == CELL_TYPE_NONE && HasNeighbor(grid, right, CELL_TYPE_WATER)) {
+        candidates[count++] = right;
+    }
+
+    if (count == 0) return;
+
+    int choice = Tick_rng_range(ctx, count);
+    size_t chosen = candidates[choice];
+
+    Tick_set_type(ctx, chosen, CELL_TYPE_LIFE);
+    Tick_mark_written(ctx, chosen);
+    SIM_COUNT(ctx, growths);
+}
+
+#endif // SIM_IMPLEMENTATION
+
+#endif // SIM_H_
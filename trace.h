@@ -0,0 +1,162 @@
+#ifndef TRACE_H_
+#define TRACE_H_
+// Timeline of the simulation and render zones, written as a Chrome trace-event JSON file
+// that opens in Perfetto (ui.perfetto.dev) or chrome://tracing. Every thread appends
+// complete events to its own ring buffer without locks, keeping the newest
+// TRACE_BUFFER_EVENTS, and the buffers are written out once all threads stopped.
+// Compiled in with TRACE, recording only once Trace_start is called. Define
+// TRACE_IMPLEMENTATION in exactly one translation unit before including this file.
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <time.h>
+#ifndef NOB_H_
+#include "nob.h"
+#endif
+
+#ifndef unwrap_null
+#define unwrap_null(x) NOB_ASSERT(x && "unwrap null pointer")
+#endif
+
+#if defined(TRACE) && !defined(PROFILE)
+#error "TRACE reuses the zones of the profiler, define PROFILE too"
+#endif
+
+// Events kept per thread, the oldest are overwritten.
+#define TRACE_BUFFER_EVENTS (1 << 17)
+#define TRACE_NO_ID -1
+
+#ifdef TRACE
+
+typedef struct {
+    const char *name; // string literal
+    uint64_t start_ns, end_ns;
+    int64_t id;       // chunk, phase or frame the event is about, or TRACE_NO_ID
+} Trace_Event;
+
+typedef struct {
+    Trace_Event events[TRACE_BUFFER_EVENTS];
+    size_t head; // events ever recorded, events[head % TRACE_BUFFER_EVENTS] is written next
+    char thread_name[32];
+    int tid;
+} Trace_Buffer;
+
+// Set once by Trace_start before any other thread starts, read-only afterwards.
+extern bool trace_enabled;
+
+static inline uint64_t Trace_now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+void Trace_start(void);
+// Names the calling thread in the trace.
+void Trace_thread(const char *name);
+// Records an event of the calling thread from `start_ns` to `end_ns`, CLOCK_MONOTONIC.
+void Trace_span(const char *name, uint64_t start_ns, uint64_t end_ns, int64_t id);
+// Writes every buffer, once no other thread records anymore.
+bool Trace_write(const char *path);
+
+// Records the statement or block that follows, see PROFILE_SCOPE for the caveats.
+#define TRACE_SCOPE(name, id) \
+    for (uint64_t trace_start_ = trace_enabled ? Trace_now_ns() : 0, trace_once_ = 1; trace_once_; \
+         trace_once_ = 0, trace_enabled ? Trace_span((name), trace_start_, Trace_now_ns(), (id)) : (void)0)
+
+#else
+
+#define TRACE_SCOPE(name, id)
+
+#endif // TRACE
+
+#ifdef TRACE_IMPLEMENTATION
+#ifdef TRACE
+
+bool trace_enabled;
+static uint64_t trace_start_ns;
+static _Thread_local Trace_Buffer *trace_buffer;
+static pthread_mutex_t trace_mutex = PTHREAD_MUTEX_INITIALIZER; // only for registering buffers
+static struct {
+    Trace_Buffer **items;
+    size_t count, capacity;
+} trace_buffers;
+
+void Trace_start(void) {
+    trace_start_ns = Trace_now_ns();
+    trace_enabled = true;
+}
+
+static Trace_Buffer *Trace_buffer(void) {
+    if (trace_buffer) return trace_buffer;
+    trace_buffer = calloc(1, sizeof(*trace_buffer));
+    unwrap_null(trace_buffer);
+    pthread_mutex_lock(&trace_mutex);
+    trace_buffer->tid = trace_buffers.count + 1;
+    snprintf(trace_buffer->thread_name, sizeof(trace_buffer->thread_name), "thread %d", trace_buffer->tid);
+    nob_da_append(&trace_buffers, trace_buffer);
+    pthread_mutex_unlock(&trace_mutex);
+    return trace_buffer;
+}
+
+void Trace_thread(const char *name) {
+    if (!trace_enabled) return;
+    Trace_Buffer *buffer = Trace_buffer();
+    snprintf(buffer->thread_name, sizeof(buffer->thread_name), "%s", name);
+}
+
+void Trace_span(const char *name, uint64_t start_ns, uint64_t end_ns, int64_t id) {
+    if (!trace_enabled) return;
+    Trace_Buffer *buffer = Trace_buffer();
+    buffer->events[buffer->head++ % TRACE_BUFFER_EVENTS] = (Trace_Event) {
+        .name = name,
+        .start_ns = start_ns,
+        .end_ns = end_ns,
+        .id = id,
+    };
+}
+
+bool Trace_write(const char *path) {
+    FILE *file = fopen(path, "w");
+    if (!file) {
+        nob_log(NOB_ERROR, "Could not open %s: %s", path, strerror(errno));
+        return false;
+    }
+
+    size_t written = 0, dropped = 0;
+    fprintf(file, "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n");
+    fprintf(file, "{\"name\": \"process_name\", \"ph\": \"M\", \"pid\": 1, \"args\": {\"name\": \"sandbox\"}}");
+    nob_da_foreach(Trace_Buffer *, it, &trace_buffers) {
+        Trace_Buffer *buffer = *it;
+        fprintf(file, ",\n{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": %d, \"args\": {\"name\": \"%s\"}}",
+                buffer->tid, buffer->thread_name);
+        size_t first = buffer->head > TRACE_BUFFER_EVENTS ? buffer->head - TRACE_BUFFER_EVENTS : 0;
+        dropped += first;
+        for (size_t i = first; i < buffer->head; ++i) {
+            const Trace_Event *event = &buffer->events[i % TRACE_BUFFER_EVENTS];
+            if (event->start_ns < trace_start_ns) continue;
+            fprintf(file, ",\n{\"name\": \"%s\", \"ph\": \"X\", \"pid\": 1, \"tid\": %d, \"ts\": %.3f, \"dur\": %.3f",
+                    event->name, buffer->tid, (event->start_ns - trace_start_ns) / 1e3,
+                    (event->end_ns - event->start_ns) / 1e3);
+            if (event->id != TRACE_NO_ID) fprintf(file, ", \"args\": {\"id\": %" PRId64 "}", event->id);
+            fprintf(file, "}");
+            written++;
+        }
+    }
+    fprintf(file, "\n]}\n");
+
+    bool ok = !ferror(file);
+    ok = fclose(file) == 0 && ok;
+    if (!ok) {
+        nob_log(NOB_ERROR, "Could not write %s: %s", path, strerror(errno));
+        return false;
+    }
+    nob_log(NOB_INFO, "Wrote %zu trace events to %s", written, path);
+    if (dropped > 0) nob_log(NOB_INFO, "%zu older events were overwritten, only the newest are kept per thread", dropped);
+    return true;
+}
+
+#endif // TRACE
+#endif // TRACE_IMPLEMENTATION
+
+#endif // TRACE_H_
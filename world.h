@@ -0,0 +1,422 @@
+#ifndef WORLD_H_
+#define WORLD_H_
+// Saved worlds: the type plane of a grid and its seed, one independently encoded block per
+// chunk. A world file is mapped into memory rather than read, its header and chunk table
+// are checked up front, and a chunk is only decoded when asked for, straight into the
+// grid. Empty chunks have no payload at all. The table also tells which chunks were
+// asleep when saved: World_File_attach only decodes and wakes the others, and leaves the
+// settled ones to the grid to load the first time something reads them, so starting from
+// a large world that has mostly settled touches little more than the table. Define
+// WORLD_IMPLEMENTATION in exactly one translation unit before including this file.
+//
+// File layout, integers little-endian:
+//
+//     "SBWD", u32 version, u64 seed, u32 width, u32 height, u32 chunk size, u32 chunks
+//     chunk table, row-major: u64 payload offset, u32 payload size, u8 encoding, u8 type,
+//                             u8 flags, u8 texel of the chunk at CHUNK_LEVEL
+//     payloads
+//
+// Chunk cells are stored row-major, clipped to the grid on the last column and row of chunks.
+// Files from before the flags and texel have zeros there, every chunk of them is awake.
+#include "sim.h"
+
+#define WORLD_MAGIC "SBWD"
+#define WORLD_VERSION 1
+#define WORLD_HEADER_SIZE 32
+#define WORLD_TABLE_ENTRY_SIZE 16
+
+typedef enum {
+    WORLD_CHUNK_UNIFORM, // every cell has the type of the table entry, no payload
+    WORLD_CHUNK_RLE,     // runs of u8 type, varint length - 1, which may span rows
+    WORLD_CHUNK_PACKED,  // 4 bits per cell, low nibble first, for chunks too noisy for runs
+} World_Chunk_Encoding;
+
+static_assert(CELL_TYPE_BEDROCK < 16, "a packed chunk holds a type per nibble");
+
+#define WORLD_CHUNK_SETTLED 0x01 // asleep when saved
+
+typedef struct {
+    const uint8_t *data; // the mapped file
+    size_t size;
+    const char *path;
+    uint64_t seed;
+    int width, height;
+    int chunks_x, chunks_y;
+} World_File;
+
+// How one chunk is stored, its payload aside.
+typedef struct {
+    World_Chunk_Encoding encoding;
+    uint8_t type; // of every cell of a uniform chunk, of the first cell otherwise
+    size_t size;  // of the payload
+} World_Chunk;
+
+// Appends the payload of chunk `chunk` of the width x height cells of `types`, rows
+// `stride` cells apart, to `sb`.
+World_Chunk World_encode_chunk(Nob_String_Builder *sb, const uint8_t *types, size_t stride, int width, int height, int chunk);
+// Same for the width x height cells of `types` on their own, such as a copy of a chunk.
+World_Chunk World_encode_cells(Nob_String_Builder *sb, const uint8_t *types, size_t stride, int width, int height);
+// Decodes the payload of a chunk into `grid`, where the chunk must still be empty. Returns
+// false when the payload does not decode to exactly the cells of the chunk.
+bool World_decode_chunk(Grid *grid, int chunk, World_Chunk info, const uint8_t *payload);
+
+// Saves the cells of a grid, between ticks. Loads the chunks the grid has yet to.
+bool World_save(const char *path, Grid *grid);
+// Maps a world file and checks its header and chunk table.
+bool World_File_open(World_File *world, const char *path);
+// Decodes one chunk into a grid of the same size whose chunk is still empty.
+bool World_File_decode_chunk(const World_File *world, Grid *grid, int chunk);
+// Hands an open world to an empty grid of the same size, which keeps it mapped for as
+// long as it needs it: the chunks that were awake when saved are decoded and woken now,
+// the settled ones are loaded by the grid on first use without waking them. The world
+// is closed either way. Returns false when a chunk decoded now is broken.
+bool World_File_attach(World_File *world, Grid *grid);
+void World_File_close(World_File *world);
+
+#ifdef WORLD_IMPLEMENTATION
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+static void World_put_le(Nob_String_Builder *sb, uint64_t value, int bytes) {
+    for (int i = 0; i < bytes; ++i) nob_da_append(sb, (char)(value >> (8 * i)));
+}
+
+static void World_store_le(uint8_t *data, uint64_t value, int bytes) {
+    for (int i = 0; i < bytes; ++i) data[i] = value >> (8 * i);
+}
+
+static uint64_t World_get_le(const uint8_t *data, int bytes) {
+    uint64_t value = 0;
+    for (int i = 0; i < bytes; ++i) value |= (uint64_t)data[i] << (8 * i);
+    return value;
+}
+
+static void World_put_varint(Nob_String_Builder *sb, uint64_t value) {
+    while (value >= 0x80) {
+        nob_da_append(sb, (char)(value | 0x80));
+        value >>= 7;
+    }
+    nob_da_append(sb, (char)value);
+}
+
+static size_t World_varint_size(uint64_t value) {
+    size_t size = 1;
+    for (; value >= 0x80; value >>= 7) size++;
+    return size;
+}
+
+// Cells [x0, x1) x [y0, y1) of a chunk.
+typedef struct {
+    int x0, y0, x1, y1;
+} World_Chunk_Rect;
+
+static World_Chunk_Rect World_chunk_rect(int width, int height, int chunks_x, int chunk) {
+    int x0 = chunk % chunks_x * CHUNK_SIZE, y0 = chunk / chunks_x * CHUNK_SIZE;
+    return (World_Chunk_Rect) {
+        .x0 = x0,
+        .y0 = y0,
+        .x1 = x0 + CHUNK_SIZE < width ? x0 + CHUNK_SIZE : width,
+        .y1 = y0 + CHUNK_SIZE < height ? y0 + CHUNK_SIZE : height,
+    };
+}
+
+World_Chunk World_encode_chunk(Nob_String_Builder *sb, const uint8_t *types, size_t stride, int width, int height, int chunk) {
+    World_Chunk_Rect rect = World_chunk_rect(width, height, (width + CHUNK_SIZE - 1) / CHUNK_SIZE, chunk);
+    return World_encode_cells(sb, &types[rect.y0 * stride + rect.x0], stride, rect.x1 - rect.x0, rect.y1 - rect.y0);
+}
+
+World_Chunk World_encode_cells(Nob_String_Builder *sb, const uint8_t *types, size_t stride, int width, int height) {
+    size_t cells = (size_t)width * height;
+    uint8_t first = types[0];
+
+    // Sizes the runs first, to pick the smaller encoding.
+    size_t runs_size = 0, runs = 0;
+    uint8_t type = first;
+    size_t length = 0;
+    for (int y = 0; y < height; ++y) {
+        for (int x = 0; x < width; ++x) {
+            uint8_t cell = types[y * stride + x];
+            if (cell == type) {
+                length++;
+                continue;
+            }
+            runs_size += 1 + World_varint_size(length - 1);
+            runs++;
+            type = cell;
+            length = 1;
+        }
+    }
+    runs_size += 1 + World_varint_size(length - 1);
+
+    World_Chunk_Encoding encoding = runs == 0 ? WORLD_CHUNK_UNIFORM
+                                  : runs_size <= (cells + 1) / 2 ? WORLD_CHUNK_RLE : WORLD_CHUNK_PACKED;
+    size_t offset = sb->count;
+    if (encoding == WORLD_CHUNK_RLE) {
+        type = first;
+        length = 0;
+        for (int y = 0; y < height; ++y) {
+            for (int x = 0; x < width; ++x) {
+                uint8_t cell = types[y * stride + x];
+                if (cell == type) {
+                    length++;
+                    continue;
+                }
+                nob_da_append(sb, (char)type);
+                World_put_varint(sb, length - 1);
+                type = cell;
+                length = 1;
+            }
+        }
+        nob_da_append(sb, (char)type);
+        World_put_varint(sb, length - 1);
+    } else if (encoding == WORLD_CHUNK_PACKED) {
+        size_t i = 0;
+        uint8_t byte = 0;
+        for (int y = 0; y < height; ++y) {
+            for (int x = 0; x < width; ++x, ++i) {
+                byte |= types[y * stride + x] << (4 * (i % 2));
+                if (i % 2) {
+                    nob_da_append(sb, (char)byte);
+                    byte = 0;
+                }
+            }
+        }
+        if (i % 2) nob_da_append(sb, (char)byte);
+    }
+
+    return (World_Chunk) { .encoding = encoding, .type = first, .size = sb->count - offset };
+}
+
+bool World_save(const char *path, Grid *grid) {
+    Grid_load_all(grid);
+    const uint8_t *types = &grid->types[Grid_index(grid, 0, 0)];
+    size_t chunks = (size_t)grid->chunks_x * grid->chunks_y;
+
+    Nob_String_Builder sb = {0};
+    nob_sb_append_buf(&sb, WORLD_MAGIC, 4);
+    World_put_le(&sb, WORLD_VERSION, 4);
+    World_put_le(&sb, grid->seed, 8);
+    World_put_le(&sb, grid->width, 4);
+    World_put_le(&sb, grid->height, 4);
+    World_put_le(&sb, CHUNK_SIZE, 4);
+    World_put_le(&sb, chunks, 4);
+    size_t table = sb.count;
+    nob_da_reserve(&sb, table + chunks * WORLD_TABLE_ENTRY_SIZE);
+    memset(sb.items + table, 0, chunks * WORLD_TABLE_ENTRY_SIZE);
+    sb.count += chunks * WORLD_TABLE_ENTRY_SIZE;
+
+    for (size_t chunk = 0; chunk < chunks; ++chunk) {
+        // Offsets are from the start of the file, the payloads follow the table.
+        size_t offset = sb.count;
+        World_Chunk info = World_encode_chunk(&sb, types, grid->stride, grid->width, grid->height, chunk);
+        uint8_t *entry = (uint8_t *)sb.items + table + chunk * WORLD_TABLE_ENTRY_SIZE;
+        World_store_le(entry, offset, 8);
+        World_store_le(entry + 8, info.size, 4);
+        entry[12] = info.encoding;
+        entry[13] = info.type;
+        // Between ticks, the chunks woken for the next one are the awake ones.
+        entry[14] = atomic_load_explicit(&grid->chunks[chunk].queued, memory_order_relaxed) ? 0 : WORLD_CHUNK_SETTLED;
+        Grid_chunk_texels(grid, chunk % grid->chunks_x, chunk / grid->chunks_x, CHUNK_LEVEL, &entry[15], 1);
+    }
+
+    bool ok = nob_write_entire_file(path, sb.items, sb.count);
+    if (ok) nob_log(NOB_INFO, "Saved the %dx%d world to %s, %zu bytes", grid->width, grid->height, path, sb.count);
+    nob_sb_free(sb);
+    return ok;
+}
+
+bool World_File_open(World_File *world, const char *path) {
+    *world = (World_File) { .path = path };
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        nob_log(NOB_ERROR, "Could not open %s: %s", path, strerror(errno));
+        return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) < 0 || st.st_size < WORLD_HEADER_SIZE) {
+        nob_log(NOB_ERROR, "%s is not a world", path);
+        close(fd);
+        return false;
+    }
+    void *data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        nob_log(NOB_ERROR, "Could not map %s: %s", path, strerror(errno));
+        return false;
+    }
+    world->data = data;
+    world->size = st.st_size;
+
+    const uint8_t *header = world->data;
+    uint32_t version = World_get_le(header + 4, 4);
+    world->seed = World_get_le(header + 8, 8);
+    world->width = World_get_le(header + 16, 4);
+    world->height = World_get_le(header + 20, 4);
+    uint32_t chunk_size = World_get_le(header + 24, 4);
+    uint32_t chunks = World_get_le(header + 28, 4);
+    world->chunks_x = (world->width + CHUNK_SIZE - 1) / CHUNK_SIZE;
+    world->chunks_y = (world->height + CHUNK_SIZE - 1) / CHUNK_SIZE;
+    const char *problem = NULL;
+    if (memcmp(header, WORLD_MAGIC, 4) != 0) {
+        problem = "is not a world";
+    } else if (version != WORLD_VERSION) {
+        problem = "has an unsupported version";
+    } else if (world->width < 3 || world->width > GRID_PAGED_SIZE_MAX || world->height < 3 || world->height > GRID_PAGED_SIZE_MAX) {
+        problem = "has an unsupported size";
+    } else if (chunk_size != CHUNK_SIZE || chunks != (size_t)world->chunks_x * world->chunks_y ||
+               WORLD_HEADER_SIZE + (size_t)chunks * WORLD_TABLE_ENTRY_SIZE > world->size) {
+        problem = "has a broken chunk table";
+    }
+    for (size_t i = 0; !problem && i < chunks; ++i) {
+        const uint8_t *entry = world->data + WORLD_HEADER_SIZE + i * WORLD_TABLE_ENTRY_SIZE;
+        uint64_t offset = World_get_le(entry, 8), size = World_get_le(entry + 8, 4);
+        if (offset > world->size || size > world->size - offset || entry[12] > WORLD_CHUNK_PACKED ||
+            entry[13] > CELL_TYPE_BEDROCK || entry[15] > CELL_TYPE_BEDROCK) {
+            problem = "has a broken chunk table";
+        }
+    }
+    if (problem) {
+        nob_log(NOB_ERROR, "%s %s", path, problem);
+        World_File_close(world);
+        return false;
+    }
+    return true;
+}
+
+// Hands the cells of a chunk, in order, to the grid as runs split at the chunk rows.
+typedef struct {
+    Grid *grid;
+    World_Chunk_Rect rect;
+    int x, y; // next cell
+} World_Run_Writer;
+
+static bool World_Run_Writer_put(World_Run_Writer *writer, uint8_t type, size_t length) {
+    if (type > CELL_TYPE_BEDROCK) return false;
+    while (length > 0) {
+        if (writer->y >= writer->rect.y1) return false;
+        int count = writer->rect.x1 - writer->x;
+        if ((size_t)count > length) count = length;
+        Grid_fill_empty_run(writer->grid, writer->x, writer->y, count, type);
+        length -= count;
+        writer->x += count;
+        if (writer->x == writer->rect.x1) {
+            writer->x = writer->rect.x0;
+            writer->y++;
+        }
+    }
+    return true;
+}
+
+bool World_decode_chunk(Grid *grid, int chunk, World_Chunk info, const uint8_t *payload) {
+    size_t size = info.size;
+    World_Run_Writer writer = { .grid = grid, .rect = World_chunk_rect(grid->width, grid->height, grid->chunks_x, chunk) };
+    writer.x = writer.rect.x0;
+    writer.y = writer.rect.y0;
+    size_t cells = (size_t)(writer.rect.x1 - writer.rect.x0) * (writer.rect.y1 - writer.rect.y0);
+
+    bool ok = true;
+    switch (info.encoding) {
+    case WORLD_CHUNK_UNIFORM:
+        ok = World_Run_Writer_put(&writer, info.type, cells);
+        break;
+    case WORLD_CHUNK_RLE:
+        for (size_t i = 0; ok && i < size;) {
+            uint8_t type = payload[i++];
+            uint64_t length = 0;
+            int shift = 0;
+            for (;; shift += 7) {
+                if (i >= size || shift > 28) {
+                    ok = false;
+                    break;
+                }
+                uint8_t byte = payload[i++];
+                length |= (uint64_t)(byte & 0x7F) << shift;
+                if (!(byte & 0x80)) break;
+            }
+            ok = ok && World_Run_Writer_put(&writer, type, length + 1);
+        }
+        break;
+    case WORLD_CHUNK_PACKED:
+        if (size != (cells + 1) / 2) {
+            ok = false;
+            break;
+        }
+        for (size_t i = 0; ok && writer.y < writer.rect.y1; writer.y++) {
+            uint8_t row[CHUNK_SIZE];
+            int count = writer.rect.x1 - writer.rect.x0;
+            for (int x = 0; x < count; ++x, ++i) {
+                row[x] = payload[i / 2] >> (4 * (i % 2)) & 0xF;
+                ok = ok && row[x] <= CELL_TYPE_BEDROCK;
+            }
+            if (ok) Grid_fill_empty_row(grid, writer.rect.x0, writer.y, row, count);
+        }
+        break;
+    default:
+        ok = false;
+    }
+    return ok && writer.y == writer.rect.y1;
+}
+
+bool World_File_decode_chunk(const World_File *world, Grid *grid, int chunk) {
+    NOB_ASSERT(grid->width == world->width && grid->height == world->height && "World_File_decode_chunk");
+    const uint8_t *entry = world->data + WORLD_HEADER_SIZE + (size_t)chunk * WORLD_TABLE_ENTRY_SIZE;
+    World_Chunk info = { .encoding = entry[12], .type = entry[13], .size = World_get_le(entry + 8, 4) };
+    if (!World_decode_chunk(grid, chunk, info, world->data + World_get_le(entry, 8))) {
+        nob_log(NOB_ERROR, "%s: chunk %d is broken", world->path, chunk);
+        return false;
+    }
+    return true;
+}
+
+static bool World_File_load(void *data, Grid *grid, int chunk) {
+    return World_File_decode_chunk(data, grid, chunk);
+}
+
+static uint8_t World_File_texel(void *data, int chunk) {
+    const World_File *world = data;
+    return world->data[WORLD_HEADER_SIZE + (size_t)chunk * WORLD_TABLE_ENTRY_SIZE + 15];
+}
+
+static void World_File_free(void *data) {
+    World_File_close(data);
+    free(data);
+}
+
+bool World_File_attach(World_File *world, Grid *grid) {
+    NOB_ASSERT(grid->width == world->width && grid->height == world->height && "World_File_attach");
+    World_File *kept = malloc(sizeof(*kept));
+    unwrap_null(kept);
+    *kept = *world;
+    *world = (World_File) {0};
+    Grid_set_loader(grid, (Grid_Loader) {
+        .load = World_File_load,
+        .texel = World_File_texel,
+        .free = World_File_free,
+        .data = kept,
+    });
+
+    size_t chunks = (size_t)kept->chunks_x * kept->chunks_y;
+    for (size_t chunk = 0; chunk < chunks; ++chunk) {
+        const uint8_t *entry = kept->data + WORLD_HEADER_SIZE + chunk * WORLD_TABLE_ENTRY_SIZE;
+        bool empty = entry[12] == WORLD_CHUNK_UNIFORM && entry[13] == CELL_TYPE_NONE;
+        if (entry[14] & WORLD_CHUNK_SETTLED) {
+            grid->unloaded[chunk] = !empty;
+            continue;
+        }
+        if (!empty && !World_File_decode_chunk(kept, grid, chunk)) return false;
+        World_Chunk_Rect rect = World_chunk_rect(grid->width, grid->height, grid->chunks_x, chunk);
+        Grid_wake(grid, rect.x0, rect.y0, rect.x1 - 1, rect.y1 - 1);
+    }
+    return true;
+}
+
+void World_File_close(World_File *world) {
+    if (world->data) munmap((void *)world->data, world->size);
+    *world = (World_File) {0};
+}
+
+#endif // WORLD_IMPLEMENTATION
+
+#endif // WORLD_H_